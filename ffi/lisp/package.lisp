@@ -14,7 +14,7 @@
            #:storage-get-value-size #:storage-get-property-size
            #:storage-get-file #:storage-get-description
            #:storage-set-description #:storage-get-array #:storage-delete
-           #:storage-get-property-ref #:record-get-value-ref
+           #:storage-get-property-ref #:storage-read-value
            #:with-create-storage #:with-open-storage #:with-record
            #:toucher-handle #:toucher-create #:toucher-destroy
            #:toucher-add-storage #:with-toucher #:batch-read-records
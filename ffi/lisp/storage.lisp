@@ -93,8 +93,13 @@
   (store storage-handle)
   (rec record-handle))
 
-(cffi:defcfun "record_get_value_ref" :pointer
-  (rec record-handle))
+(cffi:defcfun "storage_read_value" status
+  (store storage-handle)
+  (rec record-handle)
+  (buf :pointer)
+  (len :size)
+  (prev :pointer revision)
+  (pts :pointer microsec))
 
 (defmacro with-create-storage ((store-var mmap-file
                                 &key (open-flags (logior o-rdwr o-creat))
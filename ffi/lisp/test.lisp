@@ -41,10 +41,14 @@
     (do ((id (storage-get-base-id store) (incf id)))
         ((>= id (storage-get-max-id store)))
       (with-record (rec store id)
-        (let ((val (cffi:mem-ref (record-get-value-ref rec) '(:struct datum)))
-              (prop (storage-get-property-ref store rec)))
-          (format t "~5,'0D Rec: ~S~@[ (Prop: ~S)~]~%"
-                  id val (if (cffi:null-pointer-p prop) nil prop)))))))
+        (cffi:with-foreign-object (val '(:struct datum))
+          (try #'storage-read-value store rec val
+               (cffi:foreign-type-size '(:struct datum))
+               (cffi:null-pointer) (cffi:null-pointer))
+          (let ((prop (storage-get-property-ref store rec)))
+            (format t "~5,'0D Rec: ~S~@[ (Prop: ~S)~]~%"
+                    id (cffi:mem-ref val '(:struct datum))
+                    (if (cffi:null-pointer-p prop) nil prop))))))))
 
 (defun test-destroy ()
   (prog1 (try #'storage-destroy *pstore*)
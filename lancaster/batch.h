@@ -22,10 +22,38 @@ status batch_read_records(storage_handle store, size_t copy_size,
 			  const identifier *ids, void *values, revision *revs,
 			  microsec *times, size_t count);
 
+status batch_read_records_parallel(storage_handle store, size_t copy_size,
+				   const identifier *ids, void *values,
+				   revision *revs, microsec *times,
+				   size_t count, size_t worker_count);
+
+struct batch_field {
+    size_t offset;
+    size_t length;
+};
+
+status batch_read_fields(storage_handle store, const identifier *ids,
+			 const struct batch_field *fields, size_t field_count,
+			 void **columns, revision *revs, microsec *times,
+			 size_t count);
+
+status batch_read_snapshot(storage_handle store, size_t copy_size,
+			   const identifier *ids, void *values,
+			   revision *revs, microsec *times, size_t count,
+			   revision *epoch);
+
+status batch_read_history(storage_handle store, identifier id,
+			  size_t copy_size, void *values, revision *revs,
+			  microsec *times, size_t count);
+
 status batch_write_records(storage_handle store, size_t copy_size,
 			   const identifier *ids, const void *values,
 			   size_t count);
 
+status batch_commit_records(storage_handle store, size_t copy_size,
+			    const identifier *ids, const void *values,
+			    size_t count);
+
 status batch_read_changed_records(storage_handle store, size_t copy_size,
 				  identifier *ids, void *values,
 				  revision *revs, microsec *times,
@@ -35,6 +63,9 @@ status batch_read_changed_records(storage_handle store, size_t copy_size,
 struct batch_context;
 typedef struct batch_context *batch_context_handle;
 
+typedef status (*batch_view_func)(identifier, const void *, size_t,
+				  revision, microsec, void *);
+
 status batch_read_changed_records2(storage_handle store, size_t copy_size,
                                    identifier *ids, void *values,
                                    revision *revs, microsec *times,
@@ -42,6 +73,42 @@ status batch_read_changed_records2(storage_handle store, size_t copy_size,
                                    microsec orphan_timeout,
                                    batch_context_handle *pctx);
 
+status batch_read_logged_records(storage_handle store, size_t copy_size,
+				 identifier *ids, void *values,
+				 revision *revs, microsec *times,
+				 size_t count, microsec read_timeout,
+				 microsec orphan_timeout,
+				 batch_context_handle *pctx);
+
+status batch_read_conflated_records(storage_handle store, size_t copy_size,
+				    identifier *ids, void *values,
+				    revision *revs, microsec *times,
+				    size_t count, microsec read_timeout,
+				    microsec orphan_timeout,
+				    batch_context_handle *pctx);
+
+status batch_view_changed_records(storage_handle store,
+				  batch_view_func view_fn, void *param,
+				  size_t count, microsec read_timeout,
+				  microsec orphan_timeout,
+				  batch_context_handle *pctx);
+
+status batch_context_create(storage_handle store, batch_context_handle *pctx);
+
+/* restrict change-queue reads to records of interest */
+status batch_context_add_interest(batch_context_handle ctx,
+				  identifier from_id, identifier to_id);
+status batch_context_set_interest(batch_context_handle ctx,
+				  const unsigned char *bitmap,
+				  size_t bit_count);
+
+/* wait up to max_linger for a batch of at least min_batch entries */
+status batch_context_set_batching(batch_context_handle ctx, size_t min_batch,
+				  microsec max_linger);
+microsec batch_context_get_linger(batch_context_handle ctx);
+
+status batch_context_set_prefetch(batch_context_handle ctx, size_t ahead);
+
 status batch_context_destroy(batch_context_handle *pctx);
 
 #ifdef __cplusplus
@@ -19,13 +19,26 @@ extern "C" {
 #endif
 
 typedef int64_t microsec;
+typedef int64_t nanosec;
 
 #define MICROSEC_MIN INT64_MIN
 #define MICROSEC_MAX INT64_MAX
 
+#define NANOSEC_MIN INT64_MIN
+#define NANOSEC_MAX INT64_MAX
+
 status clock_sleep(microsec usec);
 status clock_time(microsec *pusec);
 
+/* the realtime clock, interpolated by the CPU's timestamp counter (if it
+   runs at a constant rate) between periodic readings of the system clock */
+status clock_time_ns(nanosec *pnsec);
+status clock_time_fast(microsec *pusec);
+
+/* the realtime clock as of the last scheduler tick (where available), which
+   is cheap to read but only accurate to a few milliseconds */
+status clock_time_coarse(microsec *pusec);
+
 /* RFC 3339, Section 5.6, Internet Date/Time Format */
 status clock_get_text(microsec usec, int precision,
 		      char *text, size_t text_sz);
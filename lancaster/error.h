@@ -14,6 +14,13 @@
 extern "C" {
 #endif
 
+#define ERROR_MSG_SIZE 512
+
+struct error_state {
+    int code;
+    char msg[ERROR_MSG_SIZE];
+};
+
 const char *error_get_program_name(void);
 void error_set_program_name(const char *name);
 
@@ -25,6 +32,11 @@ void error_save_last(void);
 void error_restore_last(void);
 void error_reset(void);
 
+/* NB. the last error raised by the calling thread, which unlike the last
+   error overall cannot be overwritten by errors raised in other threads */
+void error_get_thread_last(struct error_state *pstate);
+void error_set_last(const struct error_state *state);
+
 int error_msg(int code, const char *msg, ...);
 int error_eof(const char *func);
 int error_errno(const char *func);
@@ -20,15 +20,26 @@ typedef struct latency *latency_handle;
 status latency_create(latency_handle *plat);
 status latency_destroy(latency_handle *plat);
 
+/* NB. only one thread may take samples, though another may roll them */
 status latency_on_sample(latency_handle lat, double new_val);
 status latency_roll(latency_handle lat);
 
+/* add the last interval's statistics of OTHER to those of LAT */
+status latency_merge(latency_handle lat, latency_handle other);
+
 long latency_get_count(latency_handle lat);
+
+/* NB. may be called while samples are being taken */
+long latency_get_total_count(latency_handle lat);
+
 double latency_get_min(latency_handle lat);
 double latency_get_max(latency_handle lat);
 double latency_get_mean(latency_handle lat);
 double latency_get_stddev(latency_handle lat);
 
+/* PCT is in the range 0 to 100 */
+double latency_get_percentile(latency_handle lat, double pct);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,35 @@
+/*
+  Copyright (c)2018-2024 Justin Flude.
+  Use of this source code is governed by the COPYING file.
+*/
+
+/* sparse, radix directory of fixed-size entries */
+
+#ifndef PAGEDIR_H
+#define PAGEDIR_H
+
+#include <lancaster/status.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct pagedir;
+typedef struct pagedir *pagedir_handle;
+
+status pagedir_create(pagedir_handle *pdir, size_t entry_size,
+		      size_t entry_count, const void *blank_entry);
+status pagedir_destroy(pagedir_handle *pdir);
+
+size_t pagedir_get_count(pagedir_handle dir);
+size_t pagedir_get_page_count(pagedir_handle dir);
+
+const void *pagedir_lookup(pagedir_handle dir, size_t idx);
+void *pagedir_get(pagedir_handle dir, size_t idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
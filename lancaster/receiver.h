@@ -40,6 +40,14 @@ double receiver_get_mcast_min_latency(receiver_handle recv);
 double receiver_get_mcast_max_latency(receiver_handle recv);
 double receiver_get_mcast_mean_latency(receiver_handle recv);
 double receiver_get_mcast_stddev_latency(receiver_handle recv);
+double receiver_get_mcast_percentile_latency(receiver_handle recv,
+					     double pct);
+
+/* running totals, which may be read while the receiver is running */
+long receiver_get_total_tcp_gap_count(receiver_handle recv);
+long receiver_get_total_tcp_bytes_recv(receiver_handle recv);
+long receiver_get_total_mcast_bytes_recv(receiver_handle recv);
+long receiver_get_total_mcast_packets_recv(receiver_handle recv);
 
 status receiver_roll_stats(receiver_handle recv);
 
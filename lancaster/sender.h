@@ -29,6 +29,7 @@ status sender_create(sender_handle *psndr, const char *mmap_file,
 status sender_destroy(sender_handle *psndr);
 
 storage_handle sender_get_storage(sender_handle sndr);
+void sender_set_prefetch(sender_handle sndr, size_t ahead);
 unsigned short sender_get_listen_port(sender_handle sndr);
 
 status sender_run(sender_handle sndr);
@@ -45,6 +46,22 @@ double sender_get_storage_min_latency(sender_handle sndr);
 double sender_get_storage_max_latency(sender_handle sndr);
 double sender_get_storage_mean_latency(sender_handle sndr);
 double sender_get_storage_stddev_latency(sender_handle sndr);
+double sender_get_storage_percentile_latency(sender_handle sndr, double pct);
+
+/* the time for which a packet's first record waits for it to be sent */
+long sender_get_packet_count(sender_handle sndr);
+double sender_get_packet_min_latency(sender_handle sndr);
+double sender_get_packet_mean_latency(sender_handle sndr);
+double sender_get_packet_max_latency(sender_handle sndr);
+double sender_get_packet_stddev_latency(sender_handle sndr);
+double sender_get_packet_percentile_latency(sender_handle sndr, double pct);
+
+/* running totals, which may be read while the sender is running */
+long sender_get_total_tcp_gap_count(sender_handle sndr);
+long sender_get_total_tcp_bytes_sent(sender_handle sndr);
+long sender_get_total_mcast_bytes_sent(sender_handle sndr);
+long sender_get_total_mcast_packets_sent(sender_handle sndr);
+long sender_get_total_storage_record_count(sender_handle sndr);
 
 status sender_roll_stats(sender_handle sndr);
 
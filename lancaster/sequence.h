@@ -24,6 +24,12 @@ typedef int64_t sequence;
 #define HEARTBEAT_SEQ -1
 #define WILL_QUIT_SEQ -2
 
+/* a value too large for one packet is sent in fragments, one per sequence */
+#define FRAGMENT_FLAG 0x80000000UL
+
+/* sequence, timestamp and identifier, then length, offset and total length */
+#define FRAGMENT_OVERHEAD (3 * sizeof(int64_t) + 3 * sizeof(uint32_t))
+
 struct sequence_range {
     sequence low, high;
 };
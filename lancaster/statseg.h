@@ -0,0 +1,96 @@
+/*
+  Copyright (c)2018-2024 Justin Flude.
+  Use of this source code is governed by the COPYING file.
+*/
+
+/* publish statistics in a shared memory segment */
+
+#ifndef STATSEG_H
+#define STATSEG_H
+
+#include <lancaster/clock.h>
+#include <lancaster/int64.h>
+#include <lancaster/status.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STATSEG_MAGIC_NUMBER 0x57A75E60
+#define STATSEG_VERSION 1
+
+#define STATSEG_NAME_SIZE 24
+#define STATSEG_MAX_COUNTERS 16
+#define STATSEG_MAX_LATENCIES 4
+
+/* NB. the layout of a segment is fixed, so that it may be read directly by
+   other programs: all fields are naturally aligned and in host byte order */
+
+struct statseg_counter {
+    char name[STATSEG_NAME_SIZE];
+    int64_t value; /* during the last interval */
+    int64_t total; /* kept up to date between intervals, for deriving rates */
+};
+
+struct statseg_latency {
+    char name[STATSEG_NAME_SIZE];
+    int64_t count;
+    double min;
+    double mean;
+    double max;
+    double stddev;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+};
+
+/* NB. the revision is odd while the segment is being updated: a reader must
+   copy the segment and retry if the revision was odd or has since changed.
+   The update time is that of the latest totals, while the counters' values
+   and the latencies are for the interval of the given length before it */
+struct statseg_data {
+    int32_t magic;
+    int32_t version;
+    int64_t rev;
+    int64_t pid;
+    microsec update_time;
+    microsec interval_usec;
+    int64_t counter_count;
+    int64_t latency_count;
+    char program[32];
+    char storage[256];
+    struct statseg_counter counters[STATSEG_MAX_COUNTERS];
+    struct statseg_latency latencies[STATSEG_MAX_LATENCIES];
+};
+
+struct statseg;
+typedef struct statseg *statseg_handle;
+
+status statseg_create(statseg_handle *pseg, const char *mmap_file,
+		      const char *program, const char *storage_file);
+status statseg_open(statseg_handle *pseg, const char *mmap_file);
+status statseg_destroy(statseg_handle *pseg);
+
+const char *statseg_get_file(statseg_handle seg);
+
+status statseg_begin(statseg_handle seg);
+status statseg_set_counter(statseg_handle seg, size_t idx,
+			   const char *name, long value);
+status statseg_set_total(statseg_handle seg, size_t idx,
+			 const char *name, long total);
+status statseg_set_gauge(statseg_handle seg, size_t idx,
+			 const char *name, long value);
+status statseg_set_latency(statseg_handle seg, size_t idx,
+			   const struct statseg_latency *lat);
+status statseg_set_interval(statseg_handle seg, microsec interval);
+status statseg_end(statseg_handle seg, microsec now);
+
+status statseg_read(statseg_handle seg, struct statseg_data *copy);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
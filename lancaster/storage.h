@@ -34,11 +34,32 @@ typedef spin_lock revision;
 
 #define NEXT_REV(v) (((v) + 1) & SPIN_MAX)
 
+/* storage flags */
+#define STORAGE_SPARSE 1
+#define STORAGE_VARLEN 2
+#define STORAGE_ATOMIC 4
+#define STORAGE_DOUBLE 8
+#define STORAGE_NANOSEC 16
+#define STORAGE_TRACED 32
+
+struct storage_options {
+    unsigned flags;
+    size_t arena_size;
+    size_t history_depth;
+    size_t log_capacity;
+};
+
 status storage_create(storage_handle *pstore, const char *mmap_file,
 		      int open_flags, mode_t mode_flags, boolean persist,
 		      identifier base_id, identifier max_id,
 		      size_t value_size, size_t property_size,
 		      size_t q_capacity, const char *desc);
+status storage_create2(storage_handle *pstore, const char *mmap_file,
+		       int open_flags, mode_t mode_flags, boolean persist,
+		       identifier base_id, identifier max_id,
+		       size_t value_size, size_t property_size,
+		       size_t q_capacity, const char *desc,
+		       const struct storage_options *opts);
 status storage_open(storage_handle *pstore, const char *mmap_file,
 		    int open_flags);
 status storage_destroy(storage_handle *pstore);
@@ -50,6 +71,9 @@ unsigned short storage_get_file_version(storage_handle store);
 unsigned short storage_get_data_version(storage_handle store);
 status storage_set_data_version(storage_handle store, unsigned short data_ver);
 
+unsigned storage_get_flags(storage_handle store);
+void storage_get_options(storage_handle store, struct storage_options *opts);
+
 const void *storage_get_segment(storage_handle store);
 record_handle storage_get_array(storage_handle store);
 identifier storage_get_base_id(storage_handle store);
@@ -69,6 +93,11 @@ const char *storage_get_description(storage_handle store);
 status storage_set_description(storage_handle store, const char *desc);
 
 status storage_get_created_time(storage_handle store, microsec *when);
+
+/* the time now, from the clock with which records are stamped (those of a
+   nanosecond storage with the time in nanoseconds) */
+status storage_time_now(storage_handle store, microsec *pnow);
+status storage_time_now_ns(storage_handle store, nanosec *pnow);
 status storage_get_touched_time(storage_handle store, microsec *when);
 status storage_touch(storage_handle store, microsec when);
 
@@ -77,9 +106,29 @@ const q_index *storage_get_queue_head_ref(storage_handle store);
 size_t storage_get_queue_capacity(storage_handle store);
 q_index storage_get_queue_head(storage_handle store);
 status storage_write_queue(storage_handle store, identifier id);
+status storage_write_queue_batch(storage_handle store,
+				 const identifier *ids, size_t count);
 status storage_read_queue(storage_handle store, q_index idx,
 			  identifier *pident);
 
+/* hint that the record of a queue entry is about to be read */
+#define DEFAULT_PREFETCH_AHEAD 8
+
+void storage_prefetch_queue(storage_handle store, q_index idx);
+
+/* an optional log of every update to the storage, with its value */
+size_t storage_get_log_capacity(storage_handle store);
+q_index storage_get_log_head(storage_handle store);
+status storage_read_log(storage_handle store, q_index idx,
+			identifier *pident, void *buf, size_t len,
+			revision *prev, microsec *pts);
+
+/* a storage-wide epoch, which advances as each commit of updates ends */
+revision storage_get_epoch(storage_handle store);
+status storage_begin_commit(storage_handle store, revision *old_epoch);
+status storage_commit(storage_handle store, revision old_epoch);
+status storage_read_epoch(storage_handle store, revision *epoch);
+
 status storage_get_id(storage_handle store, record_handle rec,
 		      identifier *pident);
 status storage_get_record(storage_handle store, identifier id,
@@ -93,6 +142,13 @@ status storage_find_prev_used(storage_handle store, record_handle prior,
 status storage_iterate(storage_handle store, record_handle prior,
 		       storage_iterate_func iter_fn, void *param);
 
+/* NB. iter_fn is called concurrently, with params[i] for worker i */
+status storage_iterate_parallel(storage_handle store, size_t worker_count,
+				storage_iterate_func iter_fn, void **params);
+
+status storage_find_allocated(storage_handle store, identifier id,
+			      identifier *plow, identifier *phigh);
+
 status storage_sync(storage_handle store);
 status storage_reset(storage_handle store);
 
@@ -102,15 +158,79 @@ status storage_grow(storage_handle store, storage_handle *pnewstore,
 		    identifier new_base_id, identifier new_max_id,
 		    size_t new_value_size, size_t new_property_size,
 		    size_t new_q_capacity);
+status storage_grow2(storage_handle store, storage_handle *pnewstore,
+		     const char *new_mmap_file, int open_flags,
+		     identifier new_base_id, identifier new_max_id,
+		     size_t new_value_size, size_t new_property_size,
+		     size_t new_q_capacity, size_t worker_count);
 
 status storage_clear_record(storage_handle store, record_handle rec);
+
+/* NB. the record copied from must be write-locked by the caller */
 status storage_copy_record(storage_handle from_store, record_handle from_rec,
 			   storage_handle to_store, record_handle to_rec,
 			   microsec to_ts, boolean with_prop);
 
 void *storage_get_property_ref(storage_handle store, record_handle rec);
-
+size_t storage_get_property_length(storage_handle store, record_handle rec);
+
+/* variable-length properties within an arena at the end of the segment */
+size_t storage_get_arena_size(storage_handle store);
+size_t storage_get_arena_used(storage_handle store);
+status storage_resize_property(storage_handle store, record_handle rec,
+			       size_t new_size);
+
+/* NB. compaction moves properties, so fails with BLOCKED while any other
+   handle has the storage open; other threads sharing the handle must not
+   be referring to properties in place while it runs */
+status storage_compact_arena(storage_handle store);
+
+/* NB. a double-buffered storage has no one place for a record's value, so
+   must be read with storage_read_value or storage_view_value instead: it
+   has no value reference, and that of its record is not the current one */
 void *record_get_value_ref(record_handle rec);
+void *storage_get_value_ref(storage_handle store, record_handle rec);
+
+size_t storage_get_value_length(storage_handle store, record_handle rec);
+
+/* the time at which a record's value was first written, at its source,
+   which a traced storage keeps as well as the record's own timestamp */
+microsec storage_get_origin_time(storage_handle store, record_handle rec);
+status storage_set_origin_time(storage_handle store, record_handle rec,
+			       microsec when);
+status storage_set_value_length(storage_handle store, record_handle rec,
+				size_t len);
+
+/* consistent reads and writes of a record's value, which never wait on a
+   writer of an atomic or double-buffered storage (whose values must be
+   written this way) */
+status storage_read_value(storage_handle store, record_handle rec,
+			  void *buf, size_t len, revision *prev,
+			  microsec *pts);
+status storage_store_value(storage_handle store, record_handle rec,
+			   const void *val, size_t len, microsec ts,
+			   revision new_rev);
+
+/* NB. as above, but for a value that originated at another time (as when
+   replicated), whose origin is then published together with it */
+status storage_store_value2(storage_handle store, record_handle rec,
+			    const void *val, size_t len, microsec ts,
+			    microsec origin, revision new_rev);
+
+/* a validated view of a record's value, in place where possible, which
+   is passed to the function again if a writer changes it meanwhile */
+typedef status (*storage_view_func)(storage_handle, record_handle,
+				    const void *, size_t, revision, microsec,
+				    void *);
+
+status storage_view_value(storage_handle store, record_handle rec,
+			  storage_view_func view_fn, void *param);
+
+/* prior versions of a record's value, most recent first */
+size_t storage_get_history_depth(storage_handle store);
+status storage_read_history(storage_handle store, record_handle rec,
+			    void *values, size_t copy_size, revision *revs,
+			    microsec *times, size_t count);
 
 microsec record_get_timestamp(record_handle rec);
 void record_set_timestamp(record_handle rec, microsec ts);
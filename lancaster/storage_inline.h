@@ -0,0 +1,170 @@
+/*
+  Copyright (c)2018-2024 Justin Flude.
+  Use of this source code is governed by the COPYING file.
+*/
+
+/* optional inline versions of the hottest storage accessors */
+
+#ifndef STORAGE_INLINE_H
+#define STORAGE_INLINE_H
+
+#include <lancaster/error.h>
+#include <lancaster/spin.h>
+#include <lancaster/storage.h>
+#include <lancaster/sync.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define STORAGE_INLINE static __inline__
+#elif defined(__cplusplus) || \
+    (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L)
+#define STORAGE_INLINE static inline
+#else
+#define STORAGE_INLINE static
+#endif
+
+/* NB. this mirrors the layout of a record within a storage segment */
+struct fast_record {
+    volatile revision rev;
+    microsec ts;
+    char val[1];
+};
+
+#define FAST_RECORD(rec) ((struct fast_record *)(rec))
+
+/* NB. a fast path is invalidated by the storage being closed */
+struct storage_fast_path {
+    storage_handle store;
+    char *first;
+    size_t rec_size;
+    size_t val_size;
+    identifier base_id;
+    identifier max_id;
+    size_t q_mask;
+    q_index *q_head;
+    identifier *change_q;
+    boolean is_read_only;
+    boolean is_plain;
+};
+
+status storage_get_fast_path(storage_handle store,
+			     struct storage_fast_path *fp);
+
+/* NB. a copy of a common value size is of a constant size, and so is
+   expanded inline by the compiler into a few (possibly vector) moves,
+   without the call and size dispatch of the library's memcpy */
+STORAGE_INLINE void storage_copy_value(void *to, const void *from, size_t len)
+{
+    switch (len) {
+    case 8:
+	memcpy(to, from, 8);
+	break;
+    case 16:
+	memcpy(to, from, 16);
+	break;
+    case 32:
+	memcpy(to, from, 32);
+	break;
+    case 64:
+	memcpy(to, from, 64);
+	break;
+    case 128:
+	memcpy(to, from, 128);
+	break;
+    default:
+	memcpy(to, from, len);
+	break;
+    }
+}
+
+STORAGE_INLINE void *record_get_value_ref_fast(record_handle rec)
+{
+    return FAST_RECORD(rec)->val;
+}
+
+STORAGE_INLINE microsec record_get_timestamp_fast(record_handle rec)
+{
+    return FAST_RECORD(rec)->ts;
+}
+
+STORAGE_INLINE void record_set_revision_fast(record_handle rec, revision rev)
+{
+    SYNC_SYNCHRONIZE();
+    FAST_RECORD(rec)->rev = rev;
+}
+
+STORAGE_INLINE status storage_get_record_fast(
+    const struct storage_fast_path *fp, identifier id, record_handle *prec)
+{
+    if (id < fp->base_id || id >= fp->max_id)
+	return storage_get_record(fp->store, id, prec);
+
+    *prec = (record_handle)(fp->first + (id - fp->base_id) * fp->rec_size);
+    return OK;
+}
+
+STORAGE_INLINE size_t storage_get_queue_capacity_fast(
+    const struct storage_fast_path *fp)
+{
+    return fp->q_mask + 1;
+}
+
+STORAGE_INLINE status storage_write_queue_fast(
+    const struct storage_fast_path *fp, identifier id)
+{
+    if (fp->is_read_only || fp->q_mask == (size_t)-1)
+	return storage_write_queue(fp->store, id);
+
+    fp->change_q[*fp->q_head & fp->q_mask] = id;
+    SYNC_SYNCHRONIZE();
+    ++*fp->q_head;
+    return OK;
+}
+
+/* lock, copy, timestamp, release and queue a record's value in one call */
+STORAGE_INLINE status storage_write_value(const struct storage_fast_path *fp,
+					  identifier id, const void *val,
+					  size_t len, microsec ts)
+{
+    record_handle rec;
+    revision rev;
+    status st;
+
+    if (fp->is_read_only)
+	return error_msg(STORAGE_READ_ONLY,
+			 "storage_write_value: storage is read-only");
+
+    if (len > fp->val_size)
+	return error_invalid_arg("storage_write_value");
+
+    if (FAILED(st = storage_get_record_fast(fp, id, &rec)))
+	return st;
+
+    /* NB. only a contended lock is taken out of line */
+    rev = SYNC_FETCH_AND_OR(&FAST_RECORD(rec)->rev, SPIN_MASK);
+    if (rev < 0 && FAILED(st = spin_write_lock(&FAST_RECORD(rec)->rev, &rev)))
+	return st;
+
+    if (fp->is_plain) {
+	FAST_RECORD(rec)->ts = ts;
+	storage_copy_value(FAST_RECORD(rec)->val, val, len);
+    } else if (FAILED(st = storage_store_value(fp->store, rec, val, len,
+					      ts, NEXT_REV(rev)))) {
+	record_set_revision_fast(rec, rev);
+	return st;
+    }
+
+    record_set_revision_fast(rec, NEXT_REV(rev));
+
+    return fp->q_mask == (size_t)-1 ? OK : storage_write_queue_fast(fp, id);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -6,17 +6,106 @@
 
 #include <lancaster/batch.h>
 #include <lancaster/error.h>
+#include <lancaster/pagedir.h>
 #include <lancaster/signals.h>
+#include <lancaster/storage_inline.h>
+#include <lancaster/thread.h>
 #include <lancaster/xalloc.h>
 #include <string.h>
 
 #define STORAGE_CHECK_PERIOD 1000000
 
+struct conflate_stamp {
+    size_t generation;
+    size_t slot;
+};
+
 struct batch_context {
     q_index head;
+    q_index log_head;
     microsec created_time;
+    pagedir_handle stamps;
+    size_t generation;
+    identifier *window_ids;
+    size_t window_capacity;
+    identifier base_id;
+    size_t id_count;
+    unsigned char *interest;
+    size_t prefetch_ahead;
+    size_t min_batch;
+    microsec max_linger;
+    microsec linger_begin;
+    microsec last_linger;
+    microsec last_check;
 };
 
+static status context_create(storage_handle store, batch_context_handle *pctx)
+{
+    status st;
+    *pctx = XMALLOC(struct batch_context);
+    if (!*pctx)
+	return NO_MEMORY;
+
+    BZERO(*pctx);
+    (*pctx)->head = storage_get_queue_head(store);
+    (*pctx)->log_head = storage_get_log_head(store);
+    (*pctx)->base_id = storage_get_base_id(store);
+    (*pctx)->id_count = storage_get_max_id(store) - (*pctx)->base_id;
+    (*pctx)->prefetch_ahead = DEFAULT_PREFETCH_AHEAD;
+
+    if (FAILED(st = storage_get_created_time(store, &(*pctx)->created_time)))
+	XFREE(*pctx);
+
+    return st;
+}
+
+static boolean context_wants(batch_context_handle ctx, identifier id)
+{
+    size_t i;
+    if (!ctx->interest)
+	return TRUE;
+
+    i = id - ctx->base_id;
+    return i < ctx->id_count && (ctx->interest[i >> 3] & (1 << (i & 7)));
+}
+
+/* NB. a record of no interest would only evict one that is wanted */
+static void context_prefetch(storage_handle store, batch_context_handle ctx,
+			     q_index q)
+{
+    identifier id;
+    if (ctx->interest &&
+	(FAILED(storage_read_queue(store, q, &id)) || !context_wants(ctx, id)))
+	return;
+
+    storage_prefetch_queue(store, q);
+}
+
+static status context_check_storage(storage_handle store,
+				    batch_context_handle ctx, microsec now,
+				    microsec orphan_timeout,
+				    const char *func)
+{
+    status st;
+    microsec when;
+
+    if (FAILED(st = storage_get_created_time(store, &when)))
+	return st;
+
+    if (when != ctx->created_time)
+	return error_msg(STORAGE_RECREATED, "%s: storage is recreated", func);
+
+    if (orphan_timeout > 0) {
+	if (FAILED(st = storage_get_touched_time(store, &when)))
+	    return st;
+
+	if ((now - when) >= orphan_timeout)
+	    return error_msg(STORAGE_ORPHANED, "%s: storage is orphaned", func);
+    }
+
+    return OK;
+}
+
 status batch_read_records(storage_handle store, size_t copy_size,
 			  const identifier *ids, void *values, revision *revs,
 			  microsec *times, size_t count)
@@ -36,24 +125,13 @@ status batch_read_records(storage_handle store, size_t copy_size,
     for (n = 0; n < count; ++n) {
 	record_handle rec;
 	revision rev;
-	void *val;
 	status st;
 
-	if (FAILED(st = storage_get_record(store, *ids++, &rec)))
+	if (FAILED(st = storage_get_record(store, *ids++, &rec)) ||
+	    FAILED(st = storage_read_value(store, rec, values, val_sz,
+					   &rev, times)))
 	    return st;
 
-	val = record_get_value_ref(rec);
-	do {
-	    if (FAILED(st = record_read_lock(rec, &rev)))
-		return st;
-
-	    if (values)
-		memcpy(values, val, val_sz);
-
-	    if (times)
-		*times = record_get_timestamp(rec);
-	} while (rev != record_get_revision(rec));
-
 	if (revs)
 	    *revs++ = rev;
 
@@ -67,50 +145,304 @@ status batch_read_records(storage_handle store, size_t copy_size,
     return OK;
 }
 
+struct gather_args {
+    const struct batch_field *fields;
+    size_t field_count;
+    void **columns;
+    size_t row;
+    revision rev;
+    microsec ts;
+};
+
+static status gather_func(storage_handle store, record_handle rec,
+			  const void *val, size_t len, revision rev,
+			  microsec ts, void *param)
+{
+    struct gather_args *args = param;
+    size_t i;
+    (void)store;
+    (void)rec;
+    (void)len;
+
+    for (i = 0; i < args->field_count; ++i) {
+	const struct batch_field *f = &args->fields[i];
+	memcpy((char *)args->columns[i] + args->row * f->length,
+	       (const char *)val + f->offset, f->length);
+    }
+
+    args->rev = rev;
+    args->ts = ts;
+    return OK;
+}
+
+status batch_read_fields(storage_handle store, const identifier *ids,
+			 const struct batch_field *fields, size_t field_count,
+			 void **columns, revision *revs, microsec *times,
+			 size_t count)
+{
+    struct gather_args args;
+    size_t i, val_sz;
+
+    if (count == 0 || !ids || field_count == 0 || !fields || !columns)
+	return error_invalid_arg("batch_read_fields");
+
+    val_sz = storage_get_value_size(store);
+    for (i = 0; i < field_count; ++i)
+	if (fields[i].length == 0 || !columns[i] ||
+	    fields[i].offset >= val_sz ||
+	    fields[i].length > val_sz - fields[i].offset)
+	    return error_invalid_arg("batch_read_fields");
+
+    args.fields = fields;
+    args.field_count = field_count;
+    args.columns = columns;
+
+    /* NB. each field is gathered into its own dense column */
+    for (args.row = 0; args.row < count; ++args.row) {
+	record_handle rec;
+	status st;
+
+	if (FAILED(st = storage_get_record(store, *ids++, &rec)) ||
+	    FAILED(st = storage_view_value(store, rec, gather_func, &args)))
+	    return st;
+
+	if (revs)
+	    *revs++ = args.rev;
+
+	if (times)
+	    *times++ = args.ts;
+    }
+
+    return OK;
+}
+
+struct read_part {
+    storage_handle store;
+    size_t copy_size;
+    const identifier *ids;
+    void *values;
+    revision *revs;
+    microsec *times;
+    size_t count;
+    status result;
+    struct error_state error;
+};
+
+static void read_part(struct read_part *part)
+{
+    if (FAILED(part->result = batch_read_records(part->store,
+						 part->copy_size, part->ids,
+						 part->values, part->revs,
+						 part->times, part->count)))
+	error_get_thread_last(&part->error);
+}
+
+static void *read_func(thread_handle thr)
+{
+    read_part(thread_get_param(thr));
+    return NULL;
+}
+
+status batch_read_records_parallel(storage_handle store, size_t copy_size,
+				   const identifier *ids, void *values,
+				   revision *revs, microsec *times,
+				   size_t count, size_t worker_count)
+{
+    struct read_part *parts;
+    thread_handle *thrs;
+    status st = OK;
+    size_t i, chunk;
+
+    if (count == 0 || worker_count == 0)
+	return error_invalid_arg("batch_read_records_parallel");
+
+    if (worker_count > count)
+	worker_count = count;
+
+    parts = xcalloc(worker_count, sizeof(struct read_part));
+    thrs = xcalloc(worker_count, sizeof(thread_handle));
+    if (!parts || !thrs) {
+	xfree(parts);
+	xfree(thrs);
+	return NO_MEMORY;
+    }
+
+    chunk = (count + worker_count - 1) / worker_count;
+
+    /* NB. each worker fills its own slice of the caller's arrays */
+    for (i = 0; i < worker_count; ++i) {
+	size_t lo = i * chunk;
+	if (lo >= count)
+	    break;
+
+	parts[i].store = store;
+	parts[i].copy_size = copy_size;
+	parts[i].ids = ids + lo;
+	parts[i].values = values ? (char *)values + lo * copy_size : NULL;
+	parts[i].revs = revs ? revs + lo : NULL;
+	parts[i].times = times ? times + lo : NULL;
+	parts[i].count = count - lo < chunk ? count - lo : chunk;
+
+	if (i > 0 && FAILED(parts[i].result = thread_create(&thrs[i],
+							    read_func,
+							    &parts[i]))) {
+	    error_get_thread_last(&parts[i].error);
+	    break;
+	}
+    }
+
+    if (i == worker_count || !FAILED(parts[i].result))
+	read_part(&parts[0]);
+
+    for (i = 1; i < worker_count; ++i)
+	if (thrs[i]) {
+	    if (FAILED(st = thread_stop(thrs[i], NULL)) &&
+		!FAILED(parts[i].result)) {
+		parts[i].result = st;
+		error_get_thread_last(&parts[i].error);
+	    }
+
+	    thread_destroy(&thrs[i]);
+	}
+
+    /* NB. report the error of the first slice to fail, as raised by the
+       worker that read it rather than whichever failed last */
+    st = OK;
+    for (i = 0; i < worker_count; ++i)
+	if (FAILED(parts[i].result)) {
+	    error_set_last(&parts[i].error);
+	    st = parts[i].result;
+	    break;
+	}
+
+    xfree(parts);
+    xfree(thrs);
+    return st;
+}
+
+status batch_read_snapshot(storage_handle store, size_t copy_size,
+			   const identifier *ids, void *values,
+			   revision *revs, microsec *times, size_t count,
+			   revision *epoch)
+{
+    status st;
+    revision ep;
+
+    /* NB. retry until no commit has ended during the whole batch */
+    do {
+	if (FAILED(st = storage_read_epoch(store, &ep)) ||
+	    FAILED(st = batch_read_records(store, copy_size, ids, values,
+					   revs, times, count)))
+	    return st;
+    } while (ep != storage_get_epoch(store));
+
+    if (epoch)
+	*epoch = ep;
+
+    return OK;
+}
+
+status batch_read_history(storage_handle store, identifier id,
+			  size_t copy_size, void *values, revision *revs,
+			  microsec *times, size_t count)
+{
+    record_handle rec;
+    status st;
+
+    if (FAILED(st = storage_get_record(store, id, &rec)))
+	return st;
+
+    return storage_read_history(store, rec, values, copy_size, revs,
+				times, count);
+}
+
+/* NB. a record of a nanosecond storage is stamped in nanoseconds */
+static status stamp_now(storage_handle store, microsec *pstamp)
+{
+    return ((storage_get_flags(store) & STORAGE_NANOSEC)
+	    ? storage_time_now_ns(store, pstamp)
+	    : storage_time_now(store, pstamp));
+}
+
 status batch_write_records(storage_handle store, size_t copy_size,
 			   const identifier *ids, const void *values,
 			   size_t count)
 {
+    struct storage_fast_path fp;
     size_t n, val_sz;
-    boolean has_ch_q;
+    status st;
 
     if (count == 0 || !ids || !values || copy_size == 0)
 	return error_invalid_arg("batch_write_records");
 
+    if (FAILED(st = storage_get_fast_path(store, &fp)))
+	return st;
+
+    val_sz = fp.val_size;
+    if (copy_size < val_sz)
+	val_sz = copy_size;
+
+    for (n = 0; n < count; ++n) {
+	microsec now;
+	if (FAILED(st = stamp_now(store, &now)) ||
+	    FAILED(st = storage_write_value(&fp, *ids, values, val_sz, now)))
+	    return st;
+
+	values = (char *)values + copy_size;
+	++ids;
+    }
+
+    return OK;
+}
+
+status batch_commit_records(storage_handle store, size_t copy_size,
+			    const identifier *ids, const void *values,
+			    size_t count)
+{
+    size_t n, val_sz;
+    revision epoch;
+    microsec now;
+    status st;
+
+    if (count == 0 || !ids || !values || copy_size == 0)
+	return error_invalid_arg("batch_commit_records");
+
     val_sz = storage_get_value_size(store);
     if (copy_size < val_sz)
 	val_sz = copy_size;
 
-    has_ch_q = (storage_get_queue_capacity(store) > 0);
+    /* NB. the whole batch shares one timestamp and one commit */
+    if (FAILED(st = stamp_now(store, &now)) ||
+	FAILED(st = storage_begin_commit(store, &epoch)))
+	return st;
 
     for (n = 0; n < count; ++n) {
 	record_handle rec;
-	microsec now;
 	revision rev;
-	void *val;
-	status st;
 
-	if (FAILED(st = storage_get_record(store, *ids, &rec)))
-	    return st;
-
-	val = record_get_value_ref(rec);
-	if (FAILED(st = clock_time(&now)) ||
+	if (FAILED(st = storage_get_record(store, ids[n], &rec)) ||
 	    FAILED(st = record_write_lock(rec, &rev)))
-	    return st;
+	    break;
 
-	memcpy(val, values, val_sz);
+	if (FAILED(st = storage_store_value(store, rec, values, val_sz,
+					    now, NEXT_REV(rev)))) {
+	    record_set_revision(rec, rev);
+	    break;
+	}
 
-	record_set_timestamp(rec, now);
 	record_set_revision(rec, NEXT_REV(rev));
 
-	if (has_ch_q && FAILED(st = storage_write_queue(store, *ids)))
-	    return st;
+	values = (const char *)values + copy_size;
+    }
 
-	values = (char *)values + copy_size;
-	++ids;
+    if (n > 0 && storage_get_queue_capacity(store) > 0) {
+	status st2 = storage_write_queue_batch(store, ids, n);
+	if (!FAILED(st))
+	    st = st2;
     }
 
-    return OK;
+    storage_commit(store, epoch);
+    return FAILED(st) ? st : OK;
 }
 
 static status batch_is_done(microsec begin_time, microsec read_timeout,
@@ -137,6 +469,82 @@ static status batch_is_done(microsec begin_time, microsec read_timeout,
     return FALSE;
 }
 
+static status context_is_done(batch_context_handle ctx, size_t n,
+			      microsec begin_time, microsec read_timeout,
+			      boolean with_sleep)
+{
+    status st;
+    microsec now;
+
+    if (FAILED(st = batch_is_done(begin_time, read_timeout, with_sleep)) ||
+	!st || n == 0 || (n >= ctx->min_batch && ctx->linger_begin == 0))
+	return st;
+
+    if (FAILED(st = clock_time(&now)))
+	return st;
+
+    /* NB. a small batch lingers for more entries, up to a limit */
+    if (ctx->linger_begin == 0)
+	ctx->linger_begin = now;
+
+    ctx->last_linger = now - ctx->linger_begin;
+    if (n >= ctx->min_batch || ctx->last_linger >= ctx->max_linger)
+	return TRUE;
+
+    if (with_sleep && read_timeout == 0 && FAILED(st = clock_sleep(1)))
+	return st;
+
+    return FALSE;
+}
+
+/* NB. waits for entries past the context's head of the change queue (or
+   of the update log), returning TRUE once there are, or FALSE if the batch
+   is done first */
+static status context_wait(storage_handle store, batch_context_handle ctx,
+			   boolean from_log, size_t n, microsec begin_time,
+			   microsec read_timeout, microsec orphan_timeout,
+			   q_index *pnew_head, const char *func)
+{
+    status st;
+    microsec now;
+    q_index head = (from_log ? ctx->log_head : ctx->head);
+    size_t capacity;
+
+    for (;;) {
+	if (FAILED(st = clock_time(&now)))
+	    return st;
+
+	if ((now - ctx->last_check) >= STORAGE_CHECK_PERIOD) {
+	    ctx->last_check = now;
+	    if (FAILED(st = context_check_storage(store, ctx, now,
+						  orphan_timeout, func)))
+		return st;
+	}
+
+	*pnew_head = (from_log
+		      ? storage_get_log_head(store)
+		      : storage_get_queue_head(store));
+	if (*pnew_head != head)
+	    break;
+
+	if (FAILED(st = context_is_done(ctx, n, begin_time,
+					read_timeout, TRUE)))
+	    return st;
+	else if (st)
+	    return FALSE;
+    }
+
+    capacity = (from_log
+		? storage_get_log_capacity(store)
+		: storage_get_queue_capacity(store));
+
+    if ((size_t)(*pnew_head - head) > capacity)
+	return error_msg(CHANGE_QUEUE_OVERRUN, "%s: %s overrun", func,
+			 from_log ? "update log" : "change queue");
+
+    return TRUE;
+}
+
 status batch_read_changed_records(storage_handle store, size_t copy_size,
 				  identifier *ids, void *values,
 				  revision *revs, microsec *times,
@@ -193,24 +601,13 @@ status batch_read_changed_records(storage_handle store, size_t copy_size,
 	    identifier id;
 	    record_handle rec;
 	    revision rev;
-	    void *val;
 
 	    if (FAILED(st = storage_read_queue(store, q, &id)) ||
-		FAILED(st = storage_get_record(store, id, &rec)))
+		FAILED(st = storage_get_record(store, id, &rec)) ||
+		FAILED(st = storage_read_value(store, rec, values, val_sz,
+					       &rev, times)))
 		return st;
 
-	    val = record_get_value_ref(rec);
-	    do {
-		if (FAILED(st = record_read_lock(rec, &rev)))
-		    return st;
-
-		if (values)
-		    memcpy(values, val, val_sz);
-
-		if (times)
-		    *times = record_get_timestamp(rec);
-	    } while (rev != record_get_revision(rec));
-
 	    if (revs)
 		*revs++ = rev;
 
@@ -245,8 +642,8 @@ status batch_read_changed_records2(storage_handle store, size_t copy_size,
 {
     status st;
     microsec begin_time;
-    q_index new_head;
-    size_t n, val_sz, q_capacity;
+    q_index new_head, ahead;
+    size_t n, val_sz;
 
     if (count == 0 || !pctx || (!ids && !values && !revs && !times) ||
 	(values && copy_size == 0))
@@ -259,97 +656,134 @@ status batch_read_changed_records2(storage_handle store, size_t copy_size,
     if (copy_size < val_sz)
 	val_sz = copy_size;
 
-    if (!*pctx) {
-        *pctx = XMALLOC(struct batch_context);
-        if (!*pctx)
-            return NO_MEMORY;
-
-        (*pctx)->head = storage_get_queue_head(store);
-        st = storage_get_created_time(store, &(*pctx)->created_time);
-        if (FAILED(st)) {
-            XFREE(*pctx);
-            return st;
-        }
-    }
+    if (!*pctx && FAILED(st = context_create(store, pctx)))
+	return st;
 
-    q_capacity = storage_get_queue_capacity(store);
+    (*pctx)->linger_begin = (*pctx)->last_linger = 0;
+
+    ahead = (q_index)(*pctx)->prefetch_ahead;
 
     for (n = 0; n < count;) {
-	size_t avail, want;
 	q_index q;
-        microsec now, last_storage_check = 0;
 
-	for (;;) {
-            if (FAILED(st = clock_time(&now)))
-                return st;
-
-            if ((now - last_storage_check) >= STORAGE_CHECK_PERIOD) {
-                microsec when;
-                last_storage_check = now;
+	if (FAILED(st = context_wait(store, *pctx, FALSE, n, begin_time,
+				     read_timeout, orphan_timeout, &new_head,
+				     "batch_read_changed_records2")))
+	    return st;
+	else if (!st)
+	    break;
 
-                if (FAILED(st = storage_get_created_time(store, &when)))
-                    return st;
+	/* NB. prefetch records ahead, so their cache misses overlap */
+	for (q = (*pctx)->head;
+	     q < new_head && q < (*pctx)->head + ahead; ++q)
+	    context_prefetch(store, *pctx, q);
 
-                if (when != (*pctx)->created_time)
-                    return error_msg(STORAGE_RECREATED,
-                                     "batch_read_changed_records2: "
-                                     "storage is recreated");
+	for (q = (*pctx)->head; q < new_head && n < count; ++q) {
+	    identifier id;
+	    record_handle rec;
+	    revision rev;
 
-                if (orphan_timeout > 0) {
-                    if (FAILED(st = storage_get_touched_time(store, &when)))
-                        return st;
+	    if (ahead && q + ahead < new_head)
+		context_prefetch(store, *pctx, q + ahead);
 
-                    if ((now - when) >= orphan_timeout)
-                        return error_msg(STORAGE_ORPHANED,
-                                         "batch_read_changed_records2: "
-                                         "storage is orphaned");
-                }
-            }
+	    if (FAILED(st = storage_read_queue(store, q, &id)))
+		return st;
 
-	    new_head = storage_get_queue_head(store);
-	    if (new_head != (*pctx)->head)
-		break;
+	    /* NB. an uninteresting record is skipped without touching it */
+	    if (!context_wants(*pctx, id))
+		continue;
 
-	    if (FAILED(st = batch_is_done(begin_time, read_timeout, TRUE)))
+	    if (FAILED(st = storage_get_record(store, id, &rec)) ||
+		FAILED(st = storage_read_value(store, rec, values, val_sz,
+					       &rev, times)))
 		return st;
-	    else if (st)
-		return (status)n;
+
+	    if (revs)
+		*revs++ = rev;
+
+	    if (times)
+		++times;
+
+	    if (values)
+		values = (char *)values + copy_size;
+
+	    if (ids)
+		*ids++ = id;
+
+	    ++n;
 	}
 
-	avail = (size_t)(new_head - (*pctx)->head);
-	if (avail > q_capacity)
-	    return error_msg(CHANGE_QUEUE_OVERRUN,
-			     "batch_read_changed_records2: "
-			     "change queue overrun");
+	(*pctx)->head = q;
 
-	want = count - n;
-	if (avail > want)
-	    new_head = (*pctx)->head + want;
+	if (FAILED(st = context_is_done(*pctx, n, begin_time,
+					read_timeout, FALSE)))
+	    return st;
+	else if (st)
+	    break;
+    }
+
+    return (status)n;
+}
+
+status batch_read_logged_records(storage_handle store, size_t copy_size,
+				 identifier *ids, void *values,
+				 revision *revs, microsec *times,
+				 size_t count, microsec read_timeout,
+				 microsec orphan_timeout,
+				 batch_context_handle *pctx)
+{
+    status st;
+    microsec begin_time;
+    q_index new_head;
+    size_t n, val_sz;
+
+    if (count == 0 || !pctx || (!ids && !values && !revs && !times) ||
+	(values && copy_size == 0))
+	return error_invalid_arg("batch_read_logged_records");
+
+    if (storage_get_log_capacity(store) == 0)
+	return error_msg(NO_CHANGE_QUEUE,
+			 "batch_read_logged_records: no update log");
+
+    if (read_timeout >= 0 && FAILED(st = clock_time(&begin_time)))
+	return st;
+
+    val_sz = storage_get_value_size(store);
+    if (copy_size < val_sz)
+	val_sz = copy_size;
 
-	for (q = (*pctx)->head; q < new_head; ++q) {
+    if (!*pctx && FAILED(st = context_create(store, pctx)))
+	return st;
+
+    (*pctx)->linger_begin = (*pctx)->last_linger = 0;
+
+    for (n = 0; n < count;) {
+	q_index q;
+
+	if (FAILED(st = context_wait(store, *pctx, TRUE, n, begin_time,
+				     read_timeout, orphan_timeout, &new_head,
+				     "batch_read_logged_records")))
+	    return st;
+	else if (!st)
+	    break;
+
+	/* NB. each update is read from the log, not from its record, and
+	   an uninteresting one is overwritten by the next */
+	for (q = (*pctx)->log_head; q < new_head && n < count; ++q) {
 	    identifier id;
-	    record_handle rec;
-	    revision rev;
-	    void *val;
 
-	    if (FAILED(st = storage_read_queue(store, q, &id)) ||
-		FAILED(st = storage_get_record(store, id, &rec)))
+	    if (FAILED(st = storage_read_log(store, q, &id, values, val_sz,
+					     revs, times)))
 		return st;
 
-	    val = record_get_value_ref(rec);
-	    do {
-		if (FAILED(st = record_read_lock(rec, &rev)))
-		    return st;
-
-		if (values)
-		    memcpy(values, val, val_sz);
+	    if (!context_wants(*pctx, id))
+		continue;
 
-		if (times)
-		    *times = record_get_timestamp(rec);
-	    } while (rev != record_get_revision(rec));
+	    if (ids)
+		*ids++ = id;
 
 	    if (revs)
-		*revs++ = rev;
+		++revs;
 
 	    if (times)
 		++times;
@@ -357,14 +791,237 @@ status batch_read_changed_records2(storage_handle store, size_t copy_size,
 	    if (values)
 		values = (char *)values + copy_size;
 
+	    ++n;
+	}
+
+	(*pctx)->log_head = q;
+
+	if (FAILED(st = context_is_done(*pctx, n, begin_time,
+					read_timeout, FALSE)))
+	    return st;
+	else if (st)
+	    break;
+    }
+
+    return (status)n;
+}
+
+static status read_slot(storage_handle store, record_handle rec, size_t slot,
+			size_t copy_size, size_t val_sz, void *values,
+			revision *revs, microsec *times)
+{
+    return storage_read_value(store, rec,
+			      values ? (char *)values + slot * copy_size : NULL,
+			      val_sz, revs ? &revs[slot] : NULL,
+			      times ? &times[slot] : NULL);
+}
+
+status batch_read_conflated_records(storage_handle store, size_t copy_size,
+				    identifier *ids, void *values,
+				    revision *revs, microsec *times,
+				    size_t count, microsec read_timeout,
+				    microsec orphan_timeout,
+				    batch_context_handle *pctx)
+{
+    status st;
+    microsec begin_time;
+    q_index new_head;
+    identifier base_id;
+    size_t n, val_sz;
+
+    if (count == 0 || !pctx || (!ids && !values && !revs && !times) ||
+	(values && copy_size == 0))
+	return error_invalid_arg("batch_read_conflated_records");
+
+    if (read_timeout >= 0 && FAILED(st = clock_time(&begin_time)))
+	return st;
+
+    val_sz = storage_get_value_size(store);
+    if (copy_size < val_sz)
+	val_sz = copy_size;
+
+    if (!*pctx && FAILED(st = context_create(store, pctx)))
+	return st;
+
+    (*pctx)->linger_begin = (*pctx)->last_linger = 0;
+
+    base_id = storage_get_base_id(store);
+
+    if (!(*pctx)->stamps) {
+	struct conflate_stamp blank_stamp;
+	BZERO(&blank_stamp);
+	if (FAILED(st = pagedir_create(&(*pctx)->stamps,
+				       sizeof(struct conflate_stamp),
+				       storage_get_max_id(store) - base_id,
+				       &blank_stamp)))
+	    return st;
+    }
+
+    if ((*pctx)->window_capacity < count) {
+	identifier *p = xrealloc((*pctx)->window_ids,
+				 count * sizeof(identifier));
+	if (!p)
+	    return NO_MEMORY;
+
+	(*pctx)->window_ids = p;
+	(*pctx)->window_capacity = count;
+    }
+
+    /* NB. an identifier appears at most once in the batch, however many
+       windows it is gathered from */
+    ++(*pctx)->generation;
+
+    for (n = 0; n < count;) {
+	size_t m;
+	q_index q;
+
+	if (FAILED(st = context_wait(store, *pctx, FALSE, n, begin_time,
+				     read_timeout, orphan_timeout, &new_head,
+				     "batch_read_conflated_records")))
+	    return st;
+	else if (!st)
+	    break;
+
+	/* NB. gather the distinct identifiers of the window before reading
+	   any record, so each value read is no older than its last entry */
+	for (q = (*pctx)->head, m = n; q < new_head; ++q) {
+	    identifier id;
+	    record_handle rec;
+	    const struct conflate_stamp *seen;
+	    struct conflate_stamp *stamp;
+
+	    if (FAILED(st = storage_read_queue(store, q, &id)))
+		return st;
+
+	    if (!context_wants(*pctx, id))
+		continue;
+
+	    if (FAILED(st = storage_get_record(store, id, &rec)))
+		return st;
+
+	    seen = pagedir_lookup((*pctx)->stamps, id - base_id);
+	    if (seen->generation == (*pctx)->generation) {
+		/* NB. a value read from an earlier window is read again */
+		if (seen->slot < n &&
+		    FAILED(st = read_slot(store, rec, seen->slot, copy_size,
+					  val_sz, values, revs, times)))
+		    return st;
+
+		continue;
+	    }
+
+	    if (m == count)
+		break;
+
+	    stamp = pagedir_get((*pctx)->stamps, id - base_id);
+	    if (!stamp)
+		return NO_MEMORY;
+
+	    stamp->generation = (*pctx)->generation;
+	    stamp->slot = m;
+	    (*pctx)->window_ids[m++] = id;
+	}
+
+	(*pctx)->head = q;
+
+	for (; n < m; ++n) {
+	    identifier id = (*pctx)->window_ids[n];
+	    record_handle rec;
+
+	    if (FAILED(st = storage_get_record(store, id, &rec)) ||
+		FAILED(st = read_slot(store, rec, n, copy_size, val_sz,
+				      values, revs, times)))
+		return st;
+
 	    if (ids)
-		*ids++ = id;
+		ids[n] = id;
 	}
 
-	n += new_head - (*pctx)->head;
-	(*pctx)->head = new_head;
+	if (FAILED(st = context_is_done(*pctx, n, begin_time,
+					read_timeout, FALSE)))
+	    return st;
+	else if (st)
+	    break;
+    }
+
+    return (status)n;
+}
 
-	if (FAILED(st = batch_is_done(begin_time, read_timeout, FALSE)))
+struct view_args {
+    batch_view_func view_fn;
+    void *param;
+    identifier id;
+};
+
+static status view_func(storage_handle store, record_handle rec,
+			const void *val, size_t len, revision rev,
+			microsec ts, void *param)
+{
+    struct view_args *args = param;
+    (void)store;
+    (void)rec;
+    return args->view_fn(args->id, val, len, rev, ts, args->param);
+}
+
+status batch_view_changed_records(storage_handle store,
+				  batch_view_func view_fn, void *param,
+				  size_t count, microsec read_timeout,
+				  microsec orphan_timeout,
+				  batch_context_handle *pctx)
+{
+    status st;
+    microsec begin_time;
+    q_index new_head;
+    size_t n;
+    struct view_args args;
+
+    if (count == 0 || !pctx || !view_fn)
+	return error_invalid_arg("batch_view_changed_records");
+
+    if (read_timeout >= 0 && FAILED(st = clock_time(&begin_time)))
+	return st;
+
+    if (!*pctx && FAILED(st = context_create(store, pctx)))
+	return st;
+
+    (*pctx)->linger_begin = (*pctx)->last_linger = 0;
+
+    args.view_fn = view_fn;
+    args.param = param;
+
+    for (n = 0; n < count;) {
+	q_index q;
+
+	if (FAILED(st = context_wait(store, *pctx, FALSE, n, begin_time,
+				     read_timeout, orphan_timeout, &new_head,
+				     "batch_view_changed_records")))
+	    return st;
+	else if (!st)
+	    break;
+
+	for (q = (*pctx)->head; q < new_head && n < count; ++q) {
+	    record_handle rec;
+
+	    if (FAILED(st = storage_read_queue(store, q, &args.id)))
+		return st;
+
+	    if (!context_wants(*pctx, args.id))
+		continue;
+
+	    /* NB. the cursor stays on an entry whose view fails */
+	    if (FAILED(st = storage_get_record(store, args.id, &rec)) ||
+		FAILED(st = storage_view_value(store, rec, view_func, &args))) {
+		(*pctx)->head = q;
+		return st;
+	    }
+
+	    ++n;
+	}
+
+	(*pctx)->head = q;
+
+	if (FAILED(st = context_is_done(*pctx, n, begin_time,
+					read_timeout, FALSE)))
 	    return st;
 	else if (st)
 	    break;
@@ -373,10 +1030,96 @@ status batch_read_changed_records2(storage_handle store, size_t copy_size,
     return (status)n;
 }
 
+status batch_context_create(storage_handle store, batch_context_handle *pctx)
+{
+    if (!store || !pctx)
+	return error_invalid_arg("batch_context_create");
+
+    return context_create(store, pctx);
+}
+
+status batch_context_add_interest(batch_context_handle ctx,
+				  identifier from_id, identifier to_id)
+{
+    size_t i;
+
+    if (!ctx || from_id < ctx->base_id || to_id <= from_id ||
+	(size_t)(to_id - ctx->base_id) > ctx->id_count)
+	return error_invalid_arg("batch_context_add_interest");
+
+    if (!ctx->interest) {
+	ctx->interest = xcalloc((ctx->id_count + 7) >> 3, 1);
+	if (!ctx->interest)
+	    return NO_MEMORY;
+    }
+
+    for (i = from_id - ctx->base_id; i < (size_t)(to_id - ctx->base_id); ++i)
+	ctx->interest[i >> 3] |= 1 << (i & 7);
+
+    return OK;
+}
+
+status batch_context_set_interest(batch_context_handle ctx,
+				  const unsigned char *bitmap,
+				  size_t bit_count)
+{
+    size_t sz;
+
+    if (!ctx || (bitmap && bit_count > ctx->id_count))
+	return error_invalid_arg("batch_context_set_interest");
+
+    xfree(ctx->interest);
+    ctx->interest = NULL;
+
+    /* NB. a null bitmap restores interest in every record */
+    if (!bitmap)
+	return OK;
+
+    sz = (ctx->id_count + 7) >> 3;
+    ctx->interest = xcalloc(sz, 1);
+    if (!ctx->interest)
+	return NO_MEMORY;
+
+    memcpy(ctx->interest, bitmap, (bit_count + 7) >> 3);
+    if (bit_count & 7)
+	ctx->interest[bit_count >> 3] &= (1 << (bit_count & 7)) - 1;
+
+    return OK;
+}
+
+status batch_context_set_batching(batch_context_handle ctx, size_t min_batch,
+				  microsec max_linger)
+{
+    if (!ctx || max_linger < 0)
+	return error_invalid_arg("batch_context_set_batching");
+
+    ctx->min_batch = min_batch;
+    ctx->max_linger = max_linger;
+    return OK;
+}
+
+status batch_context_set_prefetch(batch_context_handle ctx, size_t ahead)
+{
+    if (!ctx)
+	return error_invalid_arg("batch_context_set_prefetch");
+
+    ctx->prefetch_ahead = ahead;
+    return OK;
+}
+
+microsec batch_context_get_linger(batch_context_handle ctx)
+{
+    return ctx->last_linger;
+}
+
 status batch_context_destroy(batch_context_handle *pctx)
 {
-    if (pctx && *pctx)
+    if (pctx && *pctx) {
+	pagedir_destroy(&(*pctx)->stamps);
+	xfree((*pctx)->window_ids);
+	xfree((*pctx)->interest);
         XFREE(*pctx);
+    }
 
     return OK;
 }
@@ -0,0 +1,438 @@
+/*
+  Copyright (c)2018-2024 Justin Flude.
+  Use of this source code is governed by the COPYING file.
+*/
+
+/* measure the speed of some library operations */
+
+#include <lancaster/a2i.h>
+#include <lancaster/batch.h>
+#include <lancaster/clock.h>
+#include <lancaster/error.h>
+#include <lancaster/int64.h>
+#include <lancaster/latency.h>
+#include <lancaster/spin.h>
+#include <lancaster/storage.h>
+#include <lancaster/storage_inline.h>
+#include <lancaster/version.h>
+#include <lancaster/xalloc.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_RECORD_COUNT (16 * 1024 * 1024)
+#define DEFAULT_QUEUE_CAPACITY (1024 * 1024)
+#define DEFAULT_VALUE_SIZE 64
+#define DEFAULT_ROUNDS 5
+#define BATCH_SIZE 1024
+#define CACHE_LINE_SIZE 64
+#define COPY_RECORD_COUNT 1024
+#define COPY_ITERATIONS (10 * 1000 * 1000)
+#define STATS_ITERATIONS (20 * 1000 * 1000)
+
+static const char *mmap_file = "shm:/bencher";
+static size_t prefetch_ahead = DEFAULT_PREFETCH_AHEAD;
+static size_t record_count = DEFAULT_RECORD_COUNT;
+static size_t q_capacity = DEFAULT_QUEUE_CAPACITY;
+static size_t value_size = DEFAULT_VALUE_SIZE;
+static size_t rounds = DEFAULT_ROUNDS;
+static uint64_t seed = 88172645463325252ULL;
+static volatile long sink;
+
+static void show_syntax(void)
+{
+    fprintf(stderr, "Syntax: %s [-v] [-f STORAGE-FILE] [-F PREFETCH-AHEAD] "
+	    "[-L] [-n ROUNDS] [-q CHANGE-QUEUE-CAPACITY] [-r RECORD-COUNT] "
+	    "[-s VALUE-SIZE] {drain|copy|stats}\n", error_get_program_name());
+
+    exit(-SYNTAX_ERROR);
+}
+
+static uint64_t next_random(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+/* NB. reading a buffer as large as the storage leaves little of the
+   storage in the cache, provided the storage is larger than the cache */
+static void evict(const char *buf, size_t sz)
+{
+    long sum = 0;
+    size_t i;
+    for (i = 0; i < sz; i += CACHE_LINE_SIZE)
+	sum += buf[i];
+
+    sink = sum;
+}
+
+static status write_records(storage_handle store, identifier *ids,
+			    void *values, size_t count)
+{
+    status st;
+    size_t i;
+    for (i = 0; i < count; i += BATCH_SIZE)
+	if (FAILED(st = batch_write_records(store, value_size, ids + i,
+					    values, (count - i < BATCH_SIZE
+						     ? count - i
+						     : BATCH_SIZE))))
+	    return st;
+
+    return OK;
+}
+
+static status drain_round(storage_handle store, identifier *ids,
+			  void *values, char *evict_buf, size_t evict_sz,
+			  double *pnsec)
+{
+    status st;
+    batch_context_handle ctx = NULL;
+    microsec begin, end;
+    size_t i, n;
+
+    if (FAILED(st = batch_context_create(store, &ctx)) ||
+	FAILED(st = batch_context_set_prefetch(ctx, prefetch_ahead)))
+	goto finish;
+
+    for (i = 0; i < q_capacity; ++i)
+	ids[i] = next_random() % record_count;
+
+    if (FAILED(st = write_records(store, ids, values, q_capacity)))
+	goto finish;
+
+    evict(evict_buf, evict_sz);
+
+    if (FAILED(st = clock_time(&begin)))
+	goto finish;
+
+    for (n = 0; n < q_capacity; n += st)
+	if (FAILED(st = batch_read_changed_records2(store, value_size, ids,
+						    values, NULL, NULL,
+						    BATCH_SIZE, 0, 0, &ctx)))
+	    goto finish;
+	else if (st == 0)
+	    break;
+
+    if (FAILED(st = clock_time(&end)))
+	goto finish;
+
+    *pnsec = (end - begin) * 1000.0 / n;
+
+finish:
+    if (ctx) {
+	error_save_last();
+	batch_context_destroy(&ctx);
+	error_restore_last();
+    }
+
+    return st;
+}
+
+static status bench_drain(void)
+{
+    status st;
+    storage_handle store;
+    identifier *ids;
+    void *values;
+    char *evict_buf;
+    size_t i, evict_sz;
+    double nsec, best = 0, total = 0;
+
+    if (FAILED(st = storage_create(&store, mmap_file, O_RDWR | O_CREAT, 0644,
+				   FALSE, 0, record_count, value_size, 0,
+				   q_capacity, "bencher")))
+	return st;
+
+    evict_sz = storage_get_segment_size(store);
+    ids = xmalloc(q_capacity * sizeof(identifier));
+    values = xcalloc(BATCH_SIZE, value_size);
+    evict_buf = xmalloc(evict_sz);
+
+    if (!ids || !values || !evict_buf) {
+	st = NO_MEMORY;
+	goto finish;
+    }
+
+    memset(evict_buf, 1, evict_sz);
+
+    /* NB. write every record once, so that no page is faulted in while
+       being timed */
+    for (i = 0; i < record_count; i += q_capacity) {
+	size_t j, count = (record_count - i < q_capacity
+			   ? record_count - i : q_capacity);
+	for (j = 0; j < count; ++j)
+	    ids[j] = i + j;
+
+	if (FAILED(st = write_records(store, ids, values, count)))
+	    goto finish;
+    }
+
+    for (i = 0; i < rounds; ++i) {
+	if (FAILED(st = drain_round(store, ids, values, evict_buf, evict_sz,
+				    &nsec)))
+	    goto finish;
+
+	if (i == 0 || nsec < best)
+	    best = nsec;
+
+	total += nsec;
+    }
+
+    if (printf("\"drain\", RECORDS: %lu, STORAGE/MB: %lu, QUEUE: %lu, "
+	       "AHEAD: %lu, REC/s: %.0f, AVG.NS/REC: %.2f, "
+	       "MIN.NS/REC: %.2f\n",
+	       (unsigned long)record_count,
+	       (unsigned long)(evict_sz >> 20),
+	       (unsigned long)q_capacity, (unsigned long)prefetch_ahead,
+	       1e9 * rounds / total, total / rounds, best) < 0)
+	st = error_errno("bench_drain: printf");
+
+finish:
+    xfree(evict_buf);
+    xfree(values);
+    xfree(ids);
+
+    error_save_last();
+    storage_destroy(&store);
+    error_restore_last();
+    return st;
+}
+
+/* NB. the records are few enough to stay in the cache, so that only the
+   cost of copying values is measured */
+static status copy_round(storage_handle store, struct storage_fast_path *fp,
+			 void *buf, double *pread_nsec, double *pwrite_nsec)
+{
+    status st;
+    microsec begin, middle, end;
+    record_handle rec;
+    revision rev;
+    long i;
+
+    if (FAILED(st = clock_time(&begin)))
+	return st;
+
+    for (i = 0; i < COPY_ITERATIONS; ++i)
+	if (FAILED(st = storage_write_value(fp, i & (COPY_RECORD_COUNT - 1),
+					    buf, value_size, i)))
+	    return st;
+
+    if (FAILED(st = clock_time(&middle)))
+	return st;
+
+    for (i = 0; i < COPY_ITERATIONS; ++i)
+	if (FAILED(st = storage_get_record(store, i & (COPY_RECORD_COUNT - 1),
+					   &rec)) ||
+	    FAILED(st = storage_read_value(store, rec, buf, value_size,
+					   &rev, NULL)))
+	    return st;
+
+    if (FAILED(st = clock_time(&end)))
+	return st;
+
+    *pwrite_nsec = (middle - begin) * 1000.0 / COPY_ITERATIONS;
+    *pread_nsec = (end - middle) * 1000.0 / COPY_ITERATIONS;
+    return OK;
+}
+
+static status bench_copy(void)
+{
+    status st;
+    storage_handle store;
+    struct storage_fast_path fp;
+    void *buf;
+    size_t i;
+    double read_nsec, write_nsec, read_best = 0, write_best = 0;
+
+    if (FAILED(st = storage_create(&store, mmap_file, O_RDWR | O_CREAT, 0644,
+				   FALSE, 0, COPY_RECORD_COUNT, value_size, 0,
+				   0, "bencher")))
+	return st;
+
+    buf = xcalloc(1, value_size);
+    if (!buf) {
+	st = NO_MEMORY;
+	goto finish;
+    }
+
+    if (FAILED(st = storage_get_fast_path(store, &fp)))
+	goto finish;
+
+    for (i = 0; i < rounds; ++i) {
+	if (FAILED(st = copy_round(store, &fp, buf, &read_nsec,
+				   &write_nsec)))
+	    goto finish;
+
+	if (i == 0 || read_nsec < read_best)
+	    read_best = read_nsec;
+
+	if (i == 0 || write_nsec < write_best)
+	    write_best = write_nsec;
+    }
+
+    if (printf("\"copy\", VALUE-SIZE: %lu, MIN.NS/READ: %.2f, "
+	       "MIN.NS/WRITE: %.2f\n", (unsigned long)value_size,
+	       read_best, write_best) < 0)
+	st = error_errno("bench_copy: printf");
+
+finish:
+    xfree(buf);
+
+    error_save_last();
+    storage_destroy(&store);
+    error_restore_last();
+    return st;
+}
+
+/* NB. the sender and receiver once took a lock to update their counters,
+   as the locked loop does, but now update them as the plain loop does */
+static status stats_round(latency_handle lat, double *psample_nsec,
+			  double *plocked_nsec, double *pplain_nsec)
+{
+    status st;
+    microsec t0, t1, t2, t3;
+    volatile spin_lock lock;
+    volatile long packets = 0, bytes = 0;
+    long i;
+
+    spin_create(&lock);
+
+    if (FAILED(st = clock_time(&t0)))
+	return st;
+
+    for (i = 0; i < STATS_ITERATIONS; ++i)
+	if (FAILED(st = latency_on_sample(lat, (double)(i & 1023))))
+	    return st;
+
+    if (FAILED(st = clock_time(&t1)))
+	return st;
+
+    for (i = 0; i < STATS_ITERATIONS; ++i) {
+	if (FAILED(st = spin_write_lock(&lock, NULL)))
+	    return st;
+
+	++packets;
+	bytes += i;
+	spin_unlock(&lock, 0);
+    }
+
+    if (FAILED(st = clock_time(&t2)))
+	return st;
+
+    for (i = 0; i < STATS_ITERATIONS; ++i) {
+	++packets;
+	bytes += i;
+    }
+
+    if (FAILED(st = clock_time(&t3)) ||
+	FAILED(st = latency_roll(lat)))
+	return st;
+
+    *psample_nsec = (t1 - t0) * 1000.0 / STATS_ITERATIONS;
+    *plocked_nsec = (t2 - t1) * 1000.0 / STATS_ITERATIONS;
+    *pplain_nsec = (t3 - t2) * 1000.0 / STATS_ITERATIONS;
+    return OK;
+}
+
+static status bench_stats(void)
+{
+    status st;
+    latency_handle lat;
+    double nsec[3], best[3];
+    size_t i, j;
+
+    if (FAILED(st = latency_create(&lat)))
+	return st;
+
+    for (i = 0; i < rounds; ++i) {
+	if (FAILED(st = stats_round(lat, &nsec[0], &nsec[1], &nsec[2])))
+	    goto finish;
+
+	for (j = 0; j < 3; ++j)
+	    if (i == 0 || nsec[j] < best[j])
+		best[j] = nsec[j];
+    }
+
+    if (printf("\"stats\", MIN.NS/SAMPLE: %.2f, MIN.NS/LOCKED: %.2f, "
+	       "MIN.NS/PLAIN: %.2f\n", best[0], best[1], best[2]) < 0)
+	st = error_errno("bench_stats: printf");
+
+finish:
+    error_save_last();
+    latency_destroy(&lat);
+    error_restore_last();
+    return st;
+}
+
+/* NB. calling the tests indirectly keeps them from being inlined into
+   main(), which the compiler optimizes as code run only once */
+static const struct bench_test {
+    const char *name;
+    status (*test_fn)(void);
+} tests[] = {
+    { "drain", bench_drain },
+    { "copy", bench_copy },
+    { "stats", bench_stats }
+};
+
+int main(int argc, char *argv[])
+{
+    size_t i;
+    int opt;
+
+    error_set_program_name(argv[0]);
+
+    while ((opt = getopt(argc, argv, "f:F:Ln:q:r:s:v")) != -1)
+	switch (opt) {
+	case 'f':
+	    mmap_file = optarg;
+	    break;
+	case 'F':
+	    if (FAILED(a2i(optarg, "%lu", &prefetch_ahead)))
+		error_report_fatal();
+	    break;
+	case 'L':
+	    error_with_timestamp(TRUE);
+	    break;
+	case 'n':
+	    if (FAILED(a2i(optarg, "%lu", &rounds)))
+		error_report_fatal();
+	    break;
+	case 'q':
+	    if (FAILED(a2i(optarg, "%lu", &q_capacity)))
+		error_report_fatal();
+	    break;
+	case 'r':
+	    if (FAILED(a2i(optarg, "%lu", &record_count)))
+		error_report_fatal();
+	    break;
+	case 's':
+	    if (FAILED(a2i(optarg, "%lu", &value_size)))
+		error_report_fatal();
+	    break;
+	case 'v':
+	    show_version("bencher");
+	    /* fall through */
+	default:
+	    show_syntax();
+	}
+
+    if ((argc - optind) != 1 || rounds == 0 || q_capacity == 0 ||
+	record_count == 0)
+	show_syntax();
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i)
+	if (strcmp(argv[optind], tests[i].name) == 0) {
+	    if (FAILED(tests[i].test_fn()))
+		error_report_fatal();
+
+	    return 0;
+	}
+
+    show_syntax();
+    return 0;
+}
@@ -6,6 +6,8 @@
 
 #include <lancaster/clock.h>
 #include <lancaster/error.h>
+#include <lancaster/spin.h>
+#include <lancaster/sync.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,6 +20,14 @@
 #include "config.h"
 #endif
 
+#if defined(LANCASTER_X86_64_CPU) && defined(__GNUC__)
+#include <cpuid.h>
+#define HAVE_TSC_CLOCK
+#endif
+
+#define CALIBRATE_NSEC (100 * 1000000)
+#define ANCHOR_NSEC (1000 * 1000000)
+
 #ifdef HAVE_NANOSLEEP
 
 status clock_sleep(microsec usec)
@@ -99,6 +109,180 @@ status clock_time(microsec *pusec)
 
 #endif
 
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_REALTIME_COARSE)
+
+status clock_time_coarse(microsec *pusec)
+{
+    struct timespec ts;
+    if (!pusec)
+	return error_invalid_arg("clock_time_coarse");
+
+    if (clock_gettime(CLOCK_REALTIME_COARSE, &ts) == -1)
+	return error_errno("clock_time_coarse: clock_gettime");
+
+    *pusec = (microsec)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    return OK;
+}
+
+#else
+
+status clock_time_coarse(microsec *pusec)
+{
+    return clock_time(pusec);
+}
+
+#endif
+
+#ifdef HAVE_CLOCK_GETTIME
+
+static status realtime_ns(nanosec *pnsec)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_REALTIME, &ts) == -1)
+	return error_errno("clock_time_ns: clock_gettime");
+
+    *pnsec = (nanosec)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    return OK;
+}
+
+#else
+
+static status realtime_ns(nanosec *pnsec)
+{
+    struct timeval tv;
+    if (gettimeofday(&tv, NULL) == -1)
+	return error_errno("clock_time_ns: gettimeofday");
+
+    *pnsec = (nanosec)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+    return OK;
+}
+
+#endif
+
+#ifdef HAVE_TSC_CLOCK
+
+static struct {
+    volatile spin_lock rev;
+    volatile int usable;
+    volatile int64_t tsc;
+    volatile nanosec nsec;
+    volatile double nsec_per_tick;
+} tsc_clock = {0, -1, 0, 0, 0.0};
+
+static int64_t read_tsc(void)
+{
+    unsigned lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((int64_t)hi << 32) | lo;
+}
+
+static int tsc_is_invariant(void)
+{
+    unsigned a, b, c, d;
+    return __get_cpuid(0x80000007, &a, &b, &c, &d) && (d & (1 << 8));
+}
+
+static status reanchor(nanosec *pnsec)
+{
+    status st;
+    int64_t tsc;
+    spin_lock rev = SYNC_FETCH_AND_OR(&tsc_clock.rev, SPIN_MASK);
+
+    /* NB. pair the system clock with the midpoint of the counter's
+       readings either side of it */
+    tsc = read_tsc();
+    st = realtime_ns(pnsec);
+    tsc += (read_tsc() - tsc) / 2;
+
+    if (FAILED(st) || rev < 0) {
+	/* NB. another thread is re-anchoring the clock meanwhile */
+	if (rev >= 0)
+	    spin_unlock(&tsc_clock.rev, rev);
+
+	return st;
+    }
+
+    if (tsc_clock.tsc == 0 || tsc <= tsc_clock.tsc) {
+	tsc_clock.tsc = tsc;
+	tsc_clock.nsec = *pnsec;
+    } else if ((*pnsec - tsc_clock.nsec) >= CALIBRATE_NSEC) {
+	/* NB. the rate is remeasured over each anchoring period, which
+	   follows any slewing of the system clock */
+	tsc_clock.nsec_per_tick =
+	    (double)(*pnsec - tsc_clock.nsec) / (tsc - tsc_clock.tsc);
+
+	tsc_clock.tsc = tsc;
+	tsc_clock.nsec = *pnsec;
+    }
+
+    spin_unlock(&tsc_clock.rev, (rev + 1) & SPIN_MAX);
+    return OK;
+}
+
+status clock_time_ns(nanosec *pnsec)
+{
+    if (!pnsec)
+	return error_invalid_arg("clock_time_ns");
+
+    if (tsc_clock.usable < 0) {
+	/* NB. the first reading of the system clock can be slow */
+	if (FAILED(realtime_ns(pnsec)))
+	    return realtime_ns(pnsec);
+
+	tsc_clock.usable = tsc_is_invariant();
+    }
+
+    if (!tsc_clock.usable)
+	return realtime_ns(pnsec);
+
+    for (;;) {
+	spin_lock rev = tsc_clock.rev;
+	nanosec elapsed;
+
+	if (rev < 0 || tsc_clock.nsec_per_tick == 0.0)
+	    break;
+
+	elapsed = (nanosec)((read_tsc() - tsc_clock.tsc) *
+			    tsc_clock.nsec_per_tick);
+
+	if (elapsed < 0 || elapsed >= ANCHOR_NSEC)
+	    break;
+
+	*pnsec = tsc_clock.nsec + elapsed;
+	if (rev == tsc_clock.rev)
+	    return OK;
+    }
+
+    return reanchor(pnsec);
+}
+
+#else
+
+status clock_time_ns(nanosec *pnsec)
+{
+    if (!pnsec)
+	return error_invalid_arg("clock_time_ns");
+
+    return realtime_ns(pnsec);
+}
+
+#endif
+
+status clock_time_fast(microsec *pusec)
+{
+    status st;
+    nanosec nsec;
+
+    if (!pusec)
+	return error_invalid_arg("clock_time_fast");
+
+    if (FAILED(st = clock_time_ns(&nsec)))
+	return st;
+
+    *pusec = nsec / 1000;
+    return OK;
+}
+
 status clock_get_text(microsec usec, int precision, char *text, size_t text_sz)
 {
     time_t t;
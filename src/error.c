@@ -18,11 +18,20 @@
 #include "config.h"
 #endif
 
+#ifdef __GNUC__
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
 static volatile spin_lock msg_lock;
-static char prog_name[256], last_msg[512], saved_msg[512];
+static char prog_name[256];
+static char last_msg[ERROR_MSG_SIZE], saved_msg[ERROR_MSG_SIZE];
 static int last_code, saved_code, saved_errno;
 static boolean with_ts;
 
+static THREAD_LOCAL struct error_state thread_last;
+
 const char *error_get_program_name(void)
 {
     return prog_name;
@@ -92,6 +101,39 @@ void error_reset(void)
 {
     last_code = 0;
     last_msg[0] = '\0';
+
+    thread_last.code = 0;
+    thread_last.msg[0] = '\0';
+}
+
+void error_get_thread_last(struct error_state *pstate)
+{
+    if (!pstate) {
+	error_invalid_arg("error_get_thread_last");
+	error_report_fatal();
+    }
+
+    *pstate = thread_last;
+}
+
+void error_set_last(const struct error_state *state)
+{
+    if (!state || state->code >= 0) {
+	error_invalid_arg("error_set_last");
+	error_report_fatal();
+    }
+
+    if (FAILED(spin_write_lock(&msg_lock, NULL)))
+	abort();
+
+    last_code = state->code;
+    strncpy(last_msg, state->msg, sizeof(last_msg) - 1);
+    last_msg[sizeof(last_msg) - 1] = '\0';
+
+    thread_last.code = last_code;
+    strcpy(thread_last.msg, last_msg);
+
+    spin_unlock(&msg_lock, 0);
 }
 
 int error_msg(int code, const char *msg, ...)
@@ -136,6 +178,9 @@ int error_msg(int code, const char *msg, ...)
 
     strncat(last_msg, buf, sizeof(last_msg) - strlen(last_msg) - 1);
 
+    thread_last.code = code;
+    strcpy(thread_last.msg, last_msg);
+
     spin_unlock(&msg_lock, 0);
     return code;
 }
@@ -223,6 +268,10 @@ void error_append_msg(const char *text)
 	abort();
 
     strcat(last_msg, text);
+
+    if (thread_last.code != 0)
+	strncat(thread_last.msg, text,
+		sizeof(thread_last.msg) - strlen(thread_last.msg) - 1);
 }
 
 void error_report_fatal(void)
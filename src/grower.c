@@ -22,7 +22,8 @@ static storage_handle old_store, new_store;
 
 static void show_syntax(void)
 {
-    fprintf(stderr, "Syntax: %s [-v] [-L] STORAGE-FILE NEW-STORAGE-FILE "
+    fprintf(stderr, "Syntax: %s [-v] [-L] [-P WORKERS] STORAGE-FILE "
+	    "NEW-STORAGE-FILE "
 	    "NEW-BASE-ID NEW-MAX-ID NEW-VALUE-SIZE NEW-PROPERTY-SIZE "
 	    "NEW-QUEUE-CAPACITY\n", error_get_program_name());
 
@@ -56,16 +57,24 @@ static size_t parse_sz(const char *text, sz_attr_func fn)
 int main(int argc, char *argv[])
 {
     identifier new_base_id, new_max_id;
-    size_t new_val_size, new_prop_size, new_q_capacity;
+    size_t new_val_size, new_prop_size, new_q_capacity, worker_count = 1;
     const char *new_file;
     int opt;
 
     error_set_program_name(argv[0]);
 
-    while ((opt = getopt(argc, argv, "Lv")) != -1)
+    while ((opt = getopt(argc, argv, "LP:v")) != -1)
 	switch (opt) {
 	case 'L':
 	    error_with_timestamp(TRUE);
+	    break;
+	case 'P':
+	    if (FAILED(a2i(optarg, "%lu", &worker_count)))
+		error_report_fatal();
+
+	    if (worker_count == 0)
+		show_syntax();
+
 	    break;
 	case 'v':
 	    show_version("grower");
@@ -87,9 +96,9 @@ int main(int argc, char *argv[])
     new_prop_size = parse_sz(argv[optind++], storage_get_property_size);
     new_q_capacity = parse_sz(argv[optind++], storage_get_queue_capacity);
 
-    if (FAILED(storage_grow(old_store, &new_store, new_file, O_CREAT,
-			    new_base_id, new_max_id, new_val_size,
-			    new_prop_size, new_q_capacity)) ||
+    if (FAILED(storage_grow2(old_store, &new_store, new_file, O_CREAT,
+			     new_base_id, new_max_id, new_val_size,
+			     new_prop_size, new_q_capacity, worker_count)) ||
 	FAILED(storage_destroy(&old_store)) ||
 	FAILED(storage_destroy(&new_store)))
 	error_report_fatal();
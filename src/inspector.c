@@ -10,6 +10,7 @@
 #include <lancaster/clock.h>
 #include <lancaster/dump.h>
 #include <lancaster/error.h>
+#include <lancaster/statseg.h>
 #include <lancaster/storage.h>
 #include <lancaster/version.h>
 #include <lancaster/xalloc.h>
@@ -28,17 +29,28 @@
 #define SHOW_DIV1 (SHOW_ATTRIBUTES | SHOW_QUEUE)
 #define SHOW_DIV2 (SHOW_RECORDS | SHOW_PROPERTIES)
 
-static revision rev_copy;
-static microsec ts_copy;
-static void *val_copy;
-static const void *val_base;
-static void *prop_copy;
-static const void *prop_base;
+/* NB. each worker copies records into its own buffers and prints them to
+   its own stream, so that the streams may be output in worker order */
+struct inspect_part {
+    int show;
+    FILE *out;
+    revision rev_copy;
+    microsec ts_copy;
+    void *val_copy;
+    size_t val_len;
+    const void *val_base;
+    void *prop_copy;
+    const void *prop_base;
+    size_t prop_copy_sz;
+    size_t prop_len;
+};
 
 static void show_syntax(void)
 {
     fprintf(stderr, "Syntax: %s [-v] [-a] [-L] [-p] [-q] [-r] [-V] "
-	    "STORAGE-FILE [RECORD-ID...]\n", error_get_program_name());
+	    "[-P WORKERS] STORAGE-FILE [RECORD-ID...]\n"
+	    "       %s [-L] -M STATISTICS-SEGMENT\n",
+	    error_get_program_name(), error_get_program_name());
 
     exit(-SYNTAX_ERROR);
 }
@@ -73,6 +85,12 @@ static status print_attributes(storage_handle store)
 	       "record size:      %lu\n"
 	       "value size:       %lu\n"
 	       "property size:    %lu\n"
+	       "storage flags:    0x%X%s%s%s%s%s%s\n"
+	       "arena size:       %lu\n"
+	       "arena used:       %lu\n"
+	       "history depth:    %lu\n"
+	       "log capacity:     %lu\n"
+	       "log head:         %lu\n"
 	       "value offset:     %lu\n"
 	       "property offset:  %lu\n"
 	       "timestamp offset: %lu\n"
@@ -95,6 +113,21 @@ static status print_attributes(storage_handle store)
 	       (unsigned long)storage_get_record_size(store),
 	       (unsigned long)storage_get_value_size(store),
 	       (unsigned long)storage_get_property_size(store),
+	       storage_get_flags(store),
+	       (storage_get_flags(store) & STORAGE_SPARSE) ? " sparse" : "",
+	       (storage_get_flags(store) & STORAGE_VARLEN)
+	       ? " variable-length" : "",
+	       (storage_get_flags(store) & STORAGE_ATOMIC) ? " atomic" : "",
+	       (storage_get_flags(store) & STORAGE_DOUBLE)
+	       ? " double-buffered" : "",
+	       (storage_get_flags(store) & STORAGE_NANOSEC)
+	       ? " nanosecond" : "",
+	       (storage_get_flags(store) & STORAGE_TRACED) ? " traced" : "",
+	       (unsigned long)storage_get_arena_size(store),
+	       (unsigned long)storage_get_arena_used(store),
+	       (unsigned long)storage_get_history_depth(store),
+	       (unsigned long)storage_get_log_capacity(store),
+	       (unsigned long)storage_get_log_head(store),
 	       (unsigned long)storage_get_value_offset(store),
 	       (unsigned long)storage_get_property_offset(store),
 	       (unsigned long)storage_get_timestamp_offset(store),
@@ -111,6 +144,52 @@ static status print_attributes(storage_handle store)
     return OK;
 }
 
+static status print_statseg(const char *stats_file)
+{
+    statseg_handle seg;
+    struct statseg_data data;
+    char updated[64];
+    int64_t i;
+    status st;
+
+    if (FAILED(st = statseg_open(&seg, stats_file)) ||
+	FAILED(st = statseg_read(seg, &data)) ||
+	FAILED(st = statseg_destroy(&seg)) ||
+	FAILED(st = clock_get_text(data.update_time, 6,
+				   updated, sizeof(updated))))
+	return st;
+
+    if (printf("segment:          %s\n"
+	       "program:          %s\n"
+	       "pid:              %" PRId64 "\n"
+	       "storage:          %s\n"
+	       "revision:         %" PRId64 "\n"
+	       "updated time:     %s\n"
+	       "interval/us:      %" PRId64 "\n",
+	       stats_file, data.program, data.pid, data.storage,
+	       data.rev, updated, data.interval_usec) < 0)
+	return error_errno("print_statseg: printf");
+
+    for (i = 0; i < data.counter_count && i < STATSEG_MAX_COUNTERS; ++i) {
+	const struct statseg_counter *c = &data.counters[i];
+	if (printf("%-17.*s %" PRId64 " (%" PRId64 ")\n",
+		   (int)sizeof(c->name), c->name, c->value, c->total) < 0)
+	    return error_errno("print_statseg: printf");
+    }
+
+    for (i = 0; i < data.latency_count && i < STATSEG_MAX_LATENCIES; ++i) {
+	const struct statseg_latency *l = &data.latencies[i];
+	if (printf("%-17.*s N: %" PRId64 ", MIN/us: %.2f, AVG/us: %.2f, "
+		   "MAX/us: %.2f, STD/us: %.2f, P50/us: %.2f, P90/us: %.2f, "
+		   "P99/us: %.2f, P99.9/us: %.2f\n",
+		   (int)sizeof(l->name), l->name, l->count, l->min, l->mean,
+		   l->max, l->stddev, l->p50, l->p90, l->p99, l->p999) < 0)
+	    return error_errno("print_statseg: printf");
+    }
+
+    return OK;
+}
+
 static status print_div1(void)
 {
     if (puts("--------------------------------------------------") < 0)
@@ -141,44 +220,58 @@ static status print_queue(storage_handle store)
     return OK;
 }
 
-static status copy_record(storage_handle store, record_handle rec)
+static status copy_record(storage_handle store, record_handle rec,
+			  struct inspect_part *part)
 {
     status st;
     size_t val_sz = storage_get_value_size(store);
-    size_t prop_sz = storage_get_property_size(store);
+    size_t prop_sz = storage_get_property_length(store, rec);
     size_t offset = (char *)rec - (char *)storage_get_segment(store);
 
-    if (!val_copy) {
-	val_copy = xmalloc(val_sz);
-	if (!val_copy)
+    if (!part->val_copy) {
+	part->val_copy = xmalloc(val_sz);
+	if (!part->val_copy)
 	    return NO_MEMORY;
     }
 
-    val_base = (char *)val_copy - offset - storage_get_value_offset(store);
+    part->val_base = (char *)part->val_copy - offset -
+	storage_get_value_offset(store);
 
-    if (prop_sz > 0 && !prop_copy) {
-	prop_copy = xmalloc(prop_sz);
-	if (!prop_copy)
+    if (prop_sz > part->prop_copy_sz) {
+	void *p = xrealloc(part->prop_copy, prop_sz);
+	if (!p)
 	    return NO_MEMORY;
+
+	part->prop_copy = p;
+	part->prop_copy_sz = prop_sz;
     }
 
-    prop_base =
-	(char *)prop_copy - offset - storage_get_property_offset(store);
+    part->prop_len = prop_sz;
+    part->prop_base = (prop_sz == 0 ? NULL :
+		       (char *)part->prop_copy -
+		       ((char *)storage_get_property_ref(store, rec) -
+			(char *)storage_get_segment(store)));
 
     do {
-	if (FAILED(st = record_read_lock(rec, &rev_copy)))
+	if (FAILED(st = record_read_lock(rec, &part->rev_copy)))
+	    return st;
+
+	part->ts_copy = record_get_timestamp(rec);
+	part->val_len = storage_get_value_length(store, rec);
+	if (FAILED(st = storage_read_value(store, rec, part->val_copy,
+					   part->val_len, NULL, NULL)))
 	    return st;
 
-	ts_copy = record_get_timestamp(rec);
-	memcpy(val_copy, record_get_value_ref(rec), val_sz);
 	if (prop_sz > 0)
-	    memcpy(prop_copy, storage_get_property_ref(store, rec), prop_sz);
-    } while (rev_copy != record_get_revision(rec));
+	    memcpy(part->prop_copy, storage_get_property_ref(store, rec),
+		   prop_sz);
+    } while (part->rev_copy != record_get_revision(rec));
 
     return OK;
 }
 
-static status print_record(storage_handle store, record_handle rec)
+static status print_record(storage_handle store, record_handle rec,
+			   struct inspect_part *part)
 {
     status st;
     identifier id;
@@ -189,43 +282,48 @@ static status print_record(storage_handle store, record_handle rec)
 	"=======================================";
 
     if (FAILED(st = storage_get_id(store, rec, &id)) ||
-	FAILED(st = clock_get_text(ts_copy, 6, ts_text, sizeof(ts_text))))
+	FAILED(st = clock_get_text((storage_get_flags(store) & STORAGE_NANOSEC)
+				   ? part->ts_copy / 1000 : part->ts_copy,
+				   6, ts_text, sizeof(ts_text))))
 	return st;
 
     st = sprintf(buf, " #%08" PRId64 " [0x%012lX] rev %08" PRId64 " %s",
-		 id, (unsigned long)rec_off, rev_copy, ts_text);
+		 id, (unsigned long)rec_off, part->rev_copy, ts_text);
     if (st < 0)
 	error_errno("print_record: sprintf");
 
-    if (printf("%s%s\n", divider + st + 1, buf) < 0)
-	return (feof(stdin) ? error_eof : error_errno)("print_record: printf");
+    if (fprintf(part->out, "%s%s\n", divider + st + 1, buf) < 0)
+	return (feof(stdin) ? error_eof : error_errno)
+	    ("print_record: fprintf");
 
     return OK;
 }
 
-static status print_value(storage_handle store)
+static status print_value(struct inspect_part *part)
 {
     status st;
-    if (FAILED(st = dump(val_copy, val_base, storage_get_value_size(store))))
+    if (part->val_len > 0 &&
+	FAILED(st = fdump(part->val_copy, part->val_base, part->val_len,
+			  part->out)))
 	return st;
 
     return OK;
 }
 
-static status print_div2(void)
+static status print_div2(struct inspect_part *part)
 {
-    if (puts("*") == EOF)
-	return (feof(stdin) ? error_eof : error_errno)("print_div2: puts");
+    if (fputs("*\n", part->out) == EOF)
+	return (feof(stdin) ? error_eof : error_errno)("print_div2: fputs");
 
     return OK;
 }
 
-static status print_property(storage_handle store)
+static status print_property(struct inspect_part *part)
 {
-    size_t sz = storage_get_property_size(store);
-    if (sz > 0) {
+    if (part->prop_len > 0) {
 	status st;
-	if (FAILED(st = dump(prop_copy, prop_base, sz)))
+	if (FAILED(st = fdump(part->prop_copy, part->prop_base,
+			      part->prop_len, part->out)))
 	    return st;
     }
 
@@ -235,27 +333,103 @@ static status print_property(storage_handle store)
 static status iter_func(storage_handle store, record_handle rec, void *param)
 {
     status st;
-    int show = (long)param;
-
-    if (FAILED(st = copy_record(store, rec)) ||
-	((show & SHOW_RECORDS) && FAILED(st = print_record(store, rec))) ||
-	((show & SHOW_VALUES) && FAILED(st = print_value(store))) ||
-	(((show & SHOW_DIV2) == SHOW_DIV2) && FAILED(print_div2())) ||
-	((show & SHOW_PROPERTIES) && FAILED(st = print_property(store))))
+    struct inspect_part *part = param;
+    int show = part->show;
+
+    if (FAILED(st = copy_record(store, rec, part)) ||
+	((show & SHOW_RECORDS) &&
+	 FAILED(st = print_record(store, rec, part))) ||
+	((show & SHOW_VALUES) && FAILED(st = print_value(part))) ||
+	(((show & SHOW_DIV2) == SHOW_DIV2) && FAILED(print_div2(part))) ||
+	((show & SHOW_PROPERTIES) && FAILED(st = print_property(part))))
 	return st;
 
     return TRUE;
 }
 
+static status print_parts(struct inspect_part *parts, size_t worker_count)
+{
+    size_t i;
+    for (i = 0; i < worker_count; ++i) {
+	char buf[BUFSIZ];
+	size_t n;
+
+	if (parts[i].out == stdout)
+	    continue;
+
+	rewind(parts[i].out);
+	while ((n = fread(buf, 1, sizeof(buf), parts[i].out)) > 0)
+	    if (fwrite(buf, 1, n, stdout) != n)
+		return error_errno("print_parts: fwrite");
+
+	if (ferror(parts[i].out))
+	    return error_errno("print_parts: fread");
+    }
+
+    return OK;
+}
+
+static status print_records(storage_handle store, int show,
+			    size_t worker_count)
+{
+    struct inspect_part *parts;
+    void **params;
+    status st = OK;
+    size_t i;
+
+    parts = xcalloc(worker_count, sizeof(struct inspect_part));
+    params = xcalloc(worker_count, sizeof(void *));
+    if (!parts || !params) {
+	xfree(parts);
+	xfree(params);
+	return NO_MEMORY;
+    }
+
+    /* NB. the first worker prints directly, the others into temporary
+       files which are copied out in order once every worker is done */
+    for (i = 0; i < worker_count; ++i) {
+	parts[i].show = show;
+	params[i] = &parts[i];
+
+	if (i == 0)
+	    parts[i].out = stdout;
+	else if (!(parts[i].out = tmpfile())) {
+	    st = error_errno("print_records: tmpfile");
+	    break;
+	}
+    }
+
+    if (!FAILED(st) &&
+	!FAILED(st = (worker_count == 1
+		      ? storage_iterate(store, NULL, iter_func, params[0])
+		      : storage_iterate_parallel(store, worker_count,
+						 iter_func, params))))
+	st = print_parts(parts, worker_count);
+
+    for (i = 0; i < worker_count; ++i) {
+	if (parts[i].out && parts[i].out != stdout)
+	    fclose(parts[i].out);
+
+	xfree(parts[i].val_copy);
+	xfree(parts[i].prop_copy);
+    }
+
+    xfree(parts);
+    xfree(params);
+    return st;
+}
+
 int main(int argc, char *argv[])
 {
     storage_handle store;
+    const char *stats_file = NULL;
+    size_t worker_count = 1;
     int show = 0;
     int opt;
 
     error_set_program_name(argv[0]);
 
-    while ((opt = getopt(argc, argv, "aLpqrvV")) != -1)
+    while ((opt = getopt(argc, argv, "aLM:pP:qrvV")) != -1)
 	switch (opt) {
 	case 'a':
 	    show |= SHOW_ATTRIBUTES;
@@ -263,8 +437,19 @@ int main(int argc, char *argv[])
 	case 'L':
 	    error_with_timestamp(TRUE);
 	    break;
+	case 'M':
+	    stats_file = optarg;
+	    break;
 	case 'p':
 	    show |= SHOW_PROPERTIES | SHOW_RECORDS;
+	    break;
+	case 'P':
+	    if (FAILED(a2i(optarg, "%lu", &worker_count)))
+		error_report_fatal();
+
+	    if (worker_count == 0)
+		show_syntax();
+
 	    break;
 	case 'q':
 	    show |= SHOW_QUEUE;
@@ -282,6 +467,16 @@ int main(int argc, char *argv[])
 	    show_syntax();
 	}
 
+    if (stats_file) {
+	if (show != 0 || optind != argc)
+	    show_syntax();
+
+	if (FAILED(print_statseg(stats_file)))
+	    error_report_fatal();
+
+	return 0;
+    }
+
     if ((argc - optind) < 1)
 	show_syntax();
 
@@ -295,23 +490,25 @@ int main(int argc, char *argv[])
 
     if (show & SHOW_RECORDS) {
 	if (optind < argc) {
+	    struct inspect_part part;
+	    BZERO(&part);
+	    part.show = show;
+	    part.out = stdout;
+
 	    for (; optind < argc; ++optind) {
 		identifier id;
 		record_handle rec = NULL;
 		if (FAILED(a2i(argv[optind], "%ld", &id)) ||
 		    FAILED(storage_get_record(store, id, &rec)) ||
-		    FAILED(iter_func(store, rec, (void *)(long)show)))
+		    FAILED(iter_func(store, rec, &part)))
 		    error_report_fatal();
 	    }
-	} else {
-	    if (FAILED(storage_iterate(store, NULL, iter_func,
-				       (void *)(long)show)))
-		error_report_fatal();
-	}
-    }
 
-    xfree(val_copy);
-    xfree(prop_copy);
+	    xfree(part.val_copy);
+	    xfree(part.prop_copy);
+	} else if (FAILED(print_records(store, show, worker_count)))
+	    error_report_fatal();
+    }
 
     if (FAILED(storage_destroy(&store)))
 	error_report_fatal();
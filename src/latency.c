@@ -4,11 +4,21 @@
 */
 
 #include <lancaster/error.h>
+#include <lancaster/int64.h>
 #include <lancaster/latency.h>
-#include <lancaster/spin.h>
 #include <lancaster/xalloc.h>
 #include <math.h>
 
+/* NB. samples are counted in a log-linear histogram of whole units (as in
+   HdrHistogram): values below 2 * SUB_BUCKET_COUNT have a bucket each, and
+   each higher power of two is divided into SUB_BUCKET_COUNT buckets, so that
+   a percentile is accurate to within 1 part in SUB_BUCKET_COUNT */
+
+#define SUB_BUCKET_BITS 5
+#define SUB_BUCKET_COUNT (1 << SUB_BUCKET_BITS)
+#define MAX_VALUE_BITS 40
+#define BUCKET_COUNT ((MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT)
+
 struct stats {
     long count;
     double min;
@@ -16,14 +26,76 @@ struct stats {
     double mean;
     double M2;
     double stddev;
+    long buckets[BUCKET_COUNT];
+};
+
+/* NB. totals are only ever written by the sampling thread, and are never
+   reset, so that a sample need not take a lock or make an atomic update -
+   rolling derives an interval's statistics from the change in the totals */
+struct totals {
+    long count;
+    double sum;
+    double sum_sq;
+    long buckets[BUCKET_COUNT];
+};
+
+/* NB. the extremes of an interval are kept in one of two slots, according
+   to the parity of the interval's epoch, and are only valid if stamped
+   with that epoch */
+struct extremes {
+    volatile long epoch;
+    volatile double min;
+    volatile double max;
 };
 
 struct latency {
     struct stats *curr;
-    struct stats *next;
-    volatile spin_lock lock;
+    volatile struct totals *totals;
+    struct totals *last;
+    struct extremes ext[2];
+    volatile long epoch;
 };
 
+static int highest_bit(uint64_t v)
+{
+#ifdef __GNUC__
+    return 63 - __builtin_clzll(v);
+#else
+    int n = 0;
+    while (v >>= 1)
+	++n;
+
+    return n;
+#endif
+}
+
+static size_t bucket_index(double val)
+{
+    uint64_t v;
+    int shift;
+
+    if (val < 2 * SUB_BUCKET_COUNT)
+	return val < 0 ? 0 : (size_t)val;
+
+    v = (val >= (double)((uint64_t)1 << MAX_VALUE_BITS)
+	 ? ((uint64_t)1 << MAX_VALUE_BITS) - 1 : (uint64_t)val);
+
+    shift = highest_bit(v) - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKET_COUNT +
+	(size_t)(v >> shift) - SUB_BUCKET_COUNT;
+}
+
+static double bucket_upper_value(size_t idx)
+{
+    int shift;
+    if (idx < 2 * SUB_BUCKET_COUNT)
+	return idx;
+
+    shift = idx / SUB_BUCKET_COUNT - 1;
+    return (double)((((uint64_t)(idx % SUB_BUCKET_COUNT + SUB_BUCKET_COUNT)
+		      + 1) << shift) - 1);
+}
+
 status latency_create(latency_handle *plat)
 {
     if (!plat)
@@ -37,14 +109,19 @@ status latency_create(latency_handle *plat)
     if (!(*plat)->curr)
 	return NO_MEMORY;
 
-    (*plat)->next = XMALLOC(struct stats);
-    if (!(*plat)->next)
+    (*plat)->totals = xcalloc(1, sizeof(struct totals));
+    if (!(*plat)->totals)
+	return NO_MEMORY;
+
+    (*plat)->last = XMALLOC(struct totals);
+    if (!(*plat)->last)
 	return NO_MEMORY;
 
     BZERO((*plat)->curr);
-    BZERO((*plat)->next);
-    spin_create(&(*plat)->lock);
+    BZERO((*plat)->last);
 
+    (*plat)->ext[0].epoch = (*plat)->ext[1].epoch = -1;
+    (*plat)->epoch = 0;
     return OK;
 }
 
@@ -54,49 +131,109 @@ status latency_destroy(latency_handle *plat)
 	return OK;
 
     xfree((*plat)->curr);
-    xfree((*plat)->next);
+    xfree((void *)(*plat)->totals);
+    xfree((*plat)->last);
     XFREE(*plat);
     return OK;
 }
 
 status latency_on_sample(latency_handle lat, double new_val)
 {
-    status st;
-    double delta;
-    if (FAILED(st = spin_write_lock(&lat->lock, NULL)))
-	return st;
+    volatile struct totals *t = lat->totals;
+    long epoch = lat->epoch;
+    struct extremes *x = &lat->ext[epoch & 1];
+
+    if (x->epoch != epoch) {
+	x->min = x->max = new_val;
+	x->epoch = epoch;
+    } else if (new_val < x->min)
+	x->min = new_val;
+    else if (new_val > x->max)
+	x->max = new_val;
+
+    ++t->buckets[bucket_index(new_val)];
+    t->sum += new_val;
+    t->sum_sq += new_val * new_val;
+    ++t->count;
+    return OK;
+}
+
+status latency_roll(latency_handle lat)
+{
+    struct stats *s = lat->curr;
+    struct extremes *x;
+    struct totals *last = lat->last;
+    long epoch = lat->epoch, count;
+    double sum, sum_sq;
+    size_t i;
+
+    /* NB. samples taken from now on belong to the next interval */
+    lat->epoch = epoch + 1;
+    x = &lat->ext[epoch & 1];
+
+    count = lat->totals->count;
+    sum = lat->totals->sum;
+    sum_sq = lat->totals->sum_sq;
+
+    for (i = 0; i < BUCKET_COUNT; ++i) {
+	long n = lat->totals->buckets[i];
+	s->buckets[i] = n - last->buckets[i];
+	last->buckets[i] = n;
+    }
 
-    delta = new_val - lat->next->mean;
-    lat->next->mean += delta / ++lat->next->count;
-    lat->next->M2 += delta * (new_val - lat->next->mean);
+    s->count = count - last->count;
+    s->mean = s->count > 0 ? (sum - last->sum) / s->count : 0;
+    s->M2 = (sum_sq - last->sum_sq) - (sum - last->sum) * s->mean;
+    if (s->M2 < 0)
+	s->M2 = 0;
 
-    if (lat->next->min == 0 || new_val < lat->next->min)
-	lat->next->min = new_val;
+    last->count = count;
+    last->sum = sum;
+    last->sum_sq = sum_sq;
 
-    if (lat->next->max == 0 || new_val > lat->next->max)
-	lat->next->max = new_val;
+    if (s->count > 0 && x->epoch == epoch) {
+	s->min = x->min;
+	s->max = x->max;
+    } else
+	s->min = s->max = 0;
 
-    spin_unlock(&lat->lock, 0);
+    s->stddev = s->count > 1 ? sqrt(s->M2 / (s->count - 1)) : 0;
     return OK;
 }
 
-status latency_roll(latency_handle lat)
+status latency_merge(latency_handle lat, latency_handle other)
 {
-    status st;
-    struct stats *tmp;
-    if (FAILED(st = spin_write_lock(&lat->lock, NULL)))
-	return st;
+    struct stats *dst, *src;
+    double delta;
+    long total;
+    size_t i;
+
+    if (!lat || !other || lat == other)
+	return error_invalid_arg("latency_merge");
+
+    dst = lat->curr;
+    src = other->curr;
+    if (src->count == 0)
+	return OK;
+
+    /* NB. combine the means and sums of squares as per Chan et al. */
+    total = dst->count + src->count;
+    delta = src->mean - dst->mean;
+
+    dst->M2 += src->M2 + delta * delta * dst->count * src->count / total;
+    dst->mean += delta * src->count / total;
+    dst->count = total;
 
-    tmp = lat->next;
-    lat->next = lat->curr;
-    lat->curr = tmp;
+    if (dst->min == 0 || (src->min != 0 && src->min < dst->min))
+	dst->min = src->min;
 
-    BZERO(lat->next);
-    spin_unlock(&lat->lock, 0);
+    if (dst->max == 0 || (src->max != 0 && src->max > dst->max))
+	dst->max = src->max;
 
-    lat->curr->stddev =
-	lat->curr->count > 1 ? sqrt(lat->curr->M2 / (lat->curr->count - 1))
-	                     : 0;
+    for (i = 0; i < BUCKET_COUNT; ++i)
+	dst->buckets[i] += src->buckets[i];
+
+    dst->stddev = dst->count > 1 ? sqrt(dst->M2 / (dst->count - 1)) : 0;
     return OK;
 }
 
@@ -105,6 +242,11 @@ long latency_get_count(latency_handle lat)
     return lat->curr->count;
 }
 
+long latency_get_total_count(latency_handle lat)
+{
+    return lat->totals->count;
+}
+
 double latency_get_min(latency_handle lat)
 {
     return lat->curr->min;
@@ -124,3 +266,33 @@ double latency_get_stddev(latency_handle lat)
 {
     return lat->curr->stddev;
 }
+
+double latency_get_percentile(latency_handle lat, double pct)
+{
+    const struct stats *s = lat->curr;
+    double val = s->max;
+    long rank, seen = 0;
+    size_t i;
+
+    if (s->count == 0 || pct >= 100)
+	return s->max;
+
+    rank = (long)ceil(pct / 100 * s->count);
+    if (rank < 1)
+	rank = 1;
+
+    for (i = 0; i < BUCKET_COUNT; ++i)
+	if ((seen += s->buckets[i]) >= rank) {
+	    val = bucket_upper_value(i);
+	    break;
+	}
+
+    /* NB. a bucket's bound may lie outside of the values actually seen */
+    if (val > s->max)
+	val = s->max;
+
+    if (val < s->min)
+	val = s->min;
+
+    return val;
+}
@@ -0,0 +1,156 @@
+/*
+  Copyright (c)2018-2024 Justin Flude.
+  Use of this source code is governed by the COPYING file.
+*/
+
+#include <lancaster/error.h>
+#include <lancaster/pagedir.h>
+#include <lancaster/xalloc.h>
+#include <limits.h>
+#include <string.h>
+
+#define PAGE_SHIFT 10
+#define PAGE_ENTRIES ((size_t)1 << PAGE_SHIFT)
+#define PAGE_MASK (PAGE_ENTRIES - 1)
+
+#define NODE_SHIFT 10
+#define NODE_SLOTS ((size_t)1 << NODE_SHIFT)
+#define NODE_MASK (NODE_SLOTS - 1)
+
+#define INDEX_BITS (CHAR_BIT * sizeof(size_t))
+
+/* NB. pages are reached through a radix tree of nodes, each of which is
+   only allocated once an entry beneath it is used, so that the memory
+   taken grows with the entries in use rather than with the entry count */
+struct pagedir {
+    void **root;
+    char *blank;
+    size_t entry_size;
+    size_t entry_count;
+    size_t used_count;
+    int depth;
+};
+
+static void free_node(void **node, int level)
+{
+    size_t i;
+    if (!node)
+	return;
+
+    for (i = 0; i < NODE_SLOTS; ++i)
+	if (level > 0)
+	    free_node(node[i], level - 1);
+	else
+	    xfree(node[i]);
+
+    xfree(node);
+}
+
+status pagedir_create(pagedir_handle *pdir, size_t entry_size,
+		      size_t entry_count, const void *blank_entry)
+{
+    size_t bits;
+    if (!pdir || entry_size == 0 || entry_count == 0 || !blank_entry)
+	return error_invalid_arg("pagedir_create");
+
+    *pdir = XMALLOC(struct pagedir);
+    if (!*pdir)
+	return NO_MEMORY;
+
+    BZERO(*pdir);
+
+    (*pdir)->entry_size = entry_size;
+    (*pdir)->entry_count = entry_count;
+
+    /* NB. the tree is just deep enough to index every entry */
+    (*pdir)->depth = 1;
+    for (bits = PAGE_SHIFT + NODE_SHIFT;
+	 bits < INDEX_BITS && ((entry_count - 1) >> bits) != 0;
+	 bits += NODE_SHIFT)
+	++(*pdir)->depth;
+
+    (*pdir)->root = xcalloc(NODE_SLOTS, sizeof(void *));
+    (*pdir)->blank = xmalloc(entry_size);
+
+    if (!(*pdir)->root || !(*pdir)->blank) {
+	error_save_last();
+	pagedir_destroy(pdir);
+	error_restore_last();
+	return NO_MEMORY;
+    }
+
+    memcpy((*pdir)->blank, blank_entry, entry_size);
+    return OK;
+}
+
+status pagedir_destroy(pagedir_handle *pdir)
+{
+    if (!pdir || !*pdir)
+	return OK;
+
+    free_node((*pdir)->root, (*pdir)->depth - 1);
+    xfree((*pdir)->blank);
+    XFREE(*pdir);
+    return OK;
+}
+
+size_t pagedir_get_count(pagedir_handle dir)
+{
+    return dir->entry_count;
+}
+
+size_t pagedir_get_page_count(pagedir_handle dir)
+{
+    return dir->used_count;
+}
+
+const void *pagedir_lookup(pagedir_handle dir, size_t idx)
+{
+    void **node = dir->root;
+    char *page;
+    int level;
+
+    for (level = dir->depth - 1; level > 0; --level) {
+	node = node[(idx >> (PAGE_SHIFT + level * NODE_SHIFT)) & NODE_MASK];
+	if (!node)
+	    return dir->blank;
+    }
+
+    page = node[(idx >> PAGE_SHIFT) & NODE_MASK];
+    return page ? page + (idx & PAGE_MASK) * dir->entry_size : dir->blank;
+}
+
+void *pagedir_get(pagedir_handle dir, size_t idx)
+{
+    void **node = dir->root, **slot;
+    char *page;
+    int level;
+
+    for (level = dir->depth - 1; level > 0; --level) {
+	slot = &node[(idx >> (PAGE_SHIFT + level * NODE_SHIFT)) & NODE_MASK];
+	if (!*slot) {
+	    *slot = xcalloc(NODE_SLOTS, sizeof(void *));
+	    if (!*slot)
+		return NULL;
+	}
+
+	node = *slot;
+    }
+
+    slot = &node[(idx >> PAGE_SHIFT) & NODE_MASK];
+    if (!*slot) {
+	size_t i;
+	char *p = xmalloc(PAGE_ENTRIES * dir->entry_size);
+	if (!p)
+	    return NULL;
+
+	for (i = 0; i < PAGE_ENTRIES; ++i)
+	    memcpy(p + i * dir->entry_size, dir->blank, dir->entry_size);
+
+	*slot = p;
+	++dir->used_count;
+    }
+
+    page = *slot;
+    return page + (idx & PAGE_MASK) * dir->entry_size;
+}
@@ -13,6 +13,7 @@
 #include <lancaster/sender.h>
 #include <lancaster/signals.h>
 #include <lancaster/socket.h>
+#include <lancaster/statseg.h>
 #include <lancaster/thread.h>
 #include <lancaster/version.h>
 #include <signal.h>
@@ -27,17 +28,20 @@
 #define DEFAULT_MCAST_TTL 1
 #define DEFAULT_ORPHAN_USEC (3 * 1000000)
 #define DISPLAY_DELAY_USEC (1 * 1000000)
+#define TOTALS_DELAY_USEC (100 * 1000)
 
 static sender_handle sndr;
 static reporter_handle reporter;
+static statseg_handle statseg;
 static char hostname[256];
 static boolean as_json, stg_stats;
 
 static void show_syntax(void)
 {
     fprintf(stderr, "Syntax: %s [-v] [-a ADVERT-ADDRESS:PORT] "
-	    "[-A ADVERT-PERIOD] [-e ENVIRONMENT] [-H HEARTBEAT-PERIOD] "
-	    "[-i DATA-INTERFACE] [-I ADVERT-INTERFACE] [-j|-s] [-l] [-L] "
+	    "[-A ADVERT-PERIOD] [-e ENVIRONMENT] [-F PREFETCH-AHEAD] "
+	    "[-H HEARTBEAT-PERIOD] [-i DATA-INTERFACE] [-I ADVERT-INTERFACE] "
+	    "[-j|-s] [-l] [-L] [-M STATISTICS-SEGMENT] "
 	    "[-O ORPHAN-TIMEOUT] [-p ERROR PREFIX] [-P MAXIMUM-PACKET-AGE] "
 	    "[-Q] [-R] [-S STATISTICS-UDP-ADDRESS:PORT] [-t TTL] STORAGE-FILE "
 	    "TCP-ADDRESS:PORT MULTICAST-ADDRESS:PORT\n",
@@ -49,13 +53,17 @@ static void show_syntax(void)
 static status output_stg(double secs)
 {
     if (printf("\"%.20s\", STG.REC/s: %.2f, STG.MIN/us: %.2f, "
-	       "STG.AVG/us: %.2f, STG.MAX/us: %.2f, STG.STD/us: %.2f%s",
+	       "STG.AVG/us: %.2f, STG.MAX/us: %.2f, STG.STD/us: %.2f, "
+	       "PKT.AVG/us: %.2f, PKT.P99/us: %.2f, PKT.MAX/us: %.2f%s",
 	       storage_get_description(sender_get_storage(sndr)),
 	       sender_get_storage_record_count(sndr) / secs,
 	       sender_get_storage_min_latency(sndr),
 	       sender_get_storage_mean_latency(sndr),
 	       sender_get_storage_max_latency(sndr),
 	       sender_get_storage_stddev_latency(sndr),
+	       sender_get_packet_mean_latency(sndr),
+	       sender_get_packet_percentile_latency(sndr, 99),
+	       sender_get_packet_max_latency(sndr),
 	       (isatty(STDOUT_FILENO) ? "\033[K\r" : "\n")) < 0)
 	return error_errno("output_stg: printf");
 
@@ -85,7 +93,14 @@ static status output_json(double secs, microsec now)
 		"\"stg_min/us\":%.2f, "
 		"\"stg_avg/us\":%.2f, "
 		"\"stg_max/us\":%.2f, "
-		"\"stg_std/us\":%.2f}",
+		"\"stg_std/us\":%.2f, "
+		"\"stg_p50/us\":%.2f, "
+		"\"stg_p90/us\":%.2f, "
+		"\"stg_p99/us\":%.2f, "
+		"\"stg_p99.9/us\":%.2f, "
+		"\"pkt_avg/us\":%.2f, "
+		"\"pkt_p99/us\":%.2f, "
+		"\"pkt_max/us\":%.2f}",
 		ts,
 		hostname,
 		storage_get_file(sender_get_storage(sndr)),
@@ -98,7 +113,14 @@ static status output_json(double secs, microsec now)
 		sender_get_storage_min_latency(sndr),
 		sender_get_storage_mean_latency(sndr),
 		sender_get_storage_max_latency(sndr),
-		sender_get_storage_stddev_latency(sndr)) < 0)
+		sender_get_storage_stddev_latency(sndr),
+		sender_get_storage_percentile_latency(sndr, 50),
+		sender_get_storage_percentile_latency(sndr, 90),
+		sender_get_storage_percentile_latency(sndr, 99),
+		sender_get_storage_percentile_latency(sndr, 99.9),
+		sender_get_packet_mean_latency(sndr),
+		sender_get_packet_percentile_latency(sndr, 99),
+		sender_get_packet_max_latency(sndr)) < 0)
 	return error_errno("output_json: sprintf");
 
     if (reporter) {
@@ -126,9 +148,91 @@ static status output_std(double secs)
     return OK;
 }
 
+static status set_totals(void)
+{
+    status st;
+    if (FAILED(st = statseg_set_gauge(statseg, 0, "recv",
+				      sender_get_receiver_count(sndr))) ||
+	FAILED(st = statseg_set_total(statseg, 1, "pkt",
+			      sender_get_total_mcast_packets_sent(sndr))) ||
+	FAILED(st = statseg_set_total(statseg, 2, "gap",
+				  sender_get_total_tcp_gap_count(sndr))) ||
+	FAILED(st = statseg_set_total(statseg, 3, "tcp_bytes",
+				  sender_get_total_tcp_bytes_sent(sndr))) ||
+	FAILED(st = statseg_set_total(statseg, 4, "mcast_bytes",
+				  sender_get_total_mcast_bytes_sent(sndr))) ||
+	FAILED(st = statseg_set_total(statseg, 5, "stg_rec",
+			      sender_get_total_storage_record_count(sndr))))
+	return st;
+
+    return OK;
+}
+
+static status publish_totals(microsec now)
+{
+    status st;
+    if (FAILED(st = statseg_begin(statseg)) ||
+	FAILED(st = set_totals()))
+	return st;
+
+    return statseg_end(statseg, now);
+}
+
+static status publish_stats(microsec now, microsec interval)
+{
+    struct statseg_latency lat;
+    status st;
+
+    if (FAILED(st = statseg_begin(statseg)) ||
+	FAILED(st = statseg_set_interval(statseg, interval)) ||
+	FAILED(st = set_totals()) ||
+	FAILED(st = statseg_set_counter(statseg, 1, "pkt",
+					sender_get_mcast_packets_sent(sndr))) ||
+	FAILED(st = statseg_set_counter(statseg, 2, "gap",
+					sender_get_tcp_gap_count(sndr))) ||
+	FAILED(st = statseg_set_counter(statseg, 3, "tcp_bytes",
+					sender_get_tcp_bytes_sent(sndr))) ||
+	FAILED(st = statseg_set_counter(statseg, 4, "mcast_bytes",
+					sender_get_mcast_bytes_sent(sndr))) ||
+	FAILED(st = statseg_set_counter(statseg, 5, "stg_rec",
+				      sender_get_storage_record_count(sndr))))
+	return st;
+
+    strcpy(lat.name, "stg");
+    lat.count = sender_get_storage_record_count(sndr);
+    lat.min = sender_get_storage_min_latency(sndr);
+    lat.mean = sender_get_storage_mean_latency(sndr);
+    lat.max = sender_get_storage_max_latency(sndr);
+    lat.stddev = sender_get_storage_stddev_latency(sndr);
+    lat.p50 = sender_get_storage_percentile_latency(sndr, 50);
+    lat.p90 = sender_get_storage_percentile_latency(sndr, 90);
+    lat.p99 = sender_get_storage_percentile_latency(sndr, 99);
+    lat.p999 = sender_get_storage_percentile_latency(sndr, 99.9);
+
+    if (FAILED(st = statseg_set_latency(statseg, 0, &lat)))
+	return st;
+
+    strcpy(lat.name, "pkt");
+    lat.count = sender_get_packet_count(sndr);
+    lat.min = sender_get_packet_min_latency(sndr);
+    lat.mean = sender_get_packet_mean_latency(sndr);
+    lat.max = sender_get_packet_max_latency(sndr);
+    lat.stddev = sender_get_packet_stddev_latency(sndr);
+    lat.p50 = sender_get_packet_percentile_latency(sndr, 50);
+    lat.p90 = sender_get_packet_percentile_latency(sndr, 90);
+    lat.p99 = sender_get_packet_percentile_latency(sndr, 99);
+    lat.p999 = sender_get_packet_percentile_latency(sndr, 99.9);
+
+    if (FAILED(st = statseg_set_latency(statseg, 1, &lat)))
+	return st;
+
+    return statseg_end(statseg, now);
+}
+
 static void *stats_func(thread_handle thr)
 {
     microsec last_print;
+    int ticks = 0;
     status st;
 
     if (FAILED(st = clock_time(&last_print))) {
@@ -140,10 +244,21 @@ static void *stats_func(thread_handle thr)
 	microsec now;
 	double secs;
 	if (FAILED(st = signal_any_raised()) ||
-	    FAILED(st = clock_sleep(DISPLAY_DELAY_USEC)) ||
+	    FAILED(st = clock_sleep(statseg ? TOTALS_DELAY_USEC
+				    : DISPLAY_DELAY_USEC)) ||
 	    FAILED(st = clock_time(&now)))
 	    break;
 
+	/* NB. the running totals in the statistics segment are updated
+	   more often than the figures for each interval */
+	if (statseg && ++ticks < DISPLAY_DELAY_USEC / TOTALS_DELAY_USEC) {
+	    if (FAILED(st = publish_totals(now)))
+		break;
+
+	    continue;
+	}
+
+	ticks = 0;
 	secs = (now - last_print) / 1000000.0;
 
 	if (stg_stats)
@@ -153,7 +268,8 @@ static void *stats_func(thread_handle thr)
 	else
 	    output_std(secs);
 
-	if (FAILED(st = sender_roll_stats(sndr)))
+	if ((statseg && FAILED(st = publish_stats(now, now - last_print))) ||
+	    FAILED(st = sender_roll_stats(sndr)))
 	    break;
 
 	last_print = now;
@@ -175,7 +291,8 @@ int main(int argc, char *argv[])
 {
     advert_handle adv = NULL;
     thread_handle stats_thread;
-    const char *mmap_file, *mcast_iface = NULL, *adv_iface = NULL;
+    const char *mmap_file, *mcast_iface = NULL, *adv_iface = NULL,
+	*stats_file = NULL;
     char mcast_addr[64], tcp_addr[64], stats_addr[64], adv_addr[64];
     unsigned short mcast_port, tcp_port, stats_port, adv_port = 0;
     boolean pub_advert = FALSE, loopback = FALSE,
@@ -185,6 +302,7 @@ int main(int argc, char *argv[])
 	adv_period = DEFAULT_ADVERT_USEC,
 	max_pkt_age = DEFAULT_MAX_PKT_AGE_USEC;
     short mcast_ttl = DEFAULT_MCAST_TTL;
+    size_t prefetch_ahead = DEFAULT_PREFETCH_AHEAD;
     void *stats_result;
     char *env = "";
     int opt;
@@ -193,7 +311,8 @@ int main(int argc, char *argv[])
     strcpy(prog_name, argv[0]);
     error_set_program_name(prog_name);
 
-    while ((opt = getopt(argc, argv, "a:A:e:H:i:I:jlLO:p:P:QRsS:t:v")) != -1)
+    while ((opt = getopt(argc, argv,
+			 "a:A:e:F:H:i:I:jlLM:O:p:P:QRsS:t:v")) != -1)
 	switch (opt) {
 	case 'a':
 	    if (FAILED(sock_addr_split(optarg, adv_addr,
@@ -209,6 +328,10 @@ int main(int argc, char *argv[])
 	case 'e':
 	    env = optarg;
 	    break;
+	case 'F':
+	    if (FAILED(a2i(optarg, "%lu", &prefetch_ahead)))
+		error_report_fatal();
+	    break;
 	case 'H':
 	    if (FAILED(a2i(optarg, "%ld", &hb_period)))
 		error_report_fatal();
@@ -234,6 +357,9 @@ int main(int argc, char *argv[])
 	case 'L':
 	    error_with_timestamp(TRUE);
 	    break;
+	case 'M':
+	    stats_file = optarg;
+	    break;
 	case 'O':
 	    if (FAILED(a2i(optarg, "%ld", &orphan_timeout)))
 		error_report_fatal();
@@ -296,9 +422,14 @@ int main(int argc, char *argv[])
 	(pub_advert &&
 	 (FAILED(advert_create(&adv, adv_addr, adv_port, adv_iface,
 			       mcast_ttl, loopback, env, adv_period)) ||
-	  FAILED(advert_publish(adv, sndr)))))
+	  FAILED(advert_publish(adv, sndr)))) ||
+	(stats_file &&
+	 FAILED(statseg_create(&statseg, stats_file,
+			       "publisher", mmap_file))))
 	error_report_fatal();
 
+    sender_set_prefetch(sndr, prefetch_ahead);
+
     if (!as_json && tcp_port == 0)
 	printf("listening on port %d\n", (int)sender_get_listen_port(sndr));
 
@@ -308,6 +439,7 @@ int main(int argc, char *argv[])
 	FAILED(thread_destroy(&stats_thread)) ||
 	FAILED((status)(long)stats_result) ||
 	FAILED(reporter_destroy(&reporter)) ||
+	FAILED(statseg_destroy(&statseg)) ||
 	FAILED(advert_destroy(&adv)) ||
 	FAILED(sender_destroy(&sndr)) ||
 	FAILED(signal_remove_handler(SIGHUP)) ||
@@ -316,6 +448,11 @@ int main(int argc, char *argv[])
 	if (!as_json)
 	    putchar('\n');
 
+	/* NB. a stopped program's statistics should not appear to be live */
+	error_save_last();
+	statseg_destroy(&statseg);
+	error_restore_last();
+
 	error_report_fatal();
     }
 
@@ -29,13 +29,14 @@
 #define QUEUE_OVERRUN 4
 
 static storage_handle store;
-static latency_handle stg_latency;
+static latency_handle stg_latency, org_latency, e2e_latency;
 static int event;
 
 static void show_syntax(void)
 {
-    fprintf(stderr, "Syntax: %s [-v] [-L] [-O ORPHAN-TIMEOUT] "
-	    "[-p ERROR PREFIX] [-Q] [-R] [-s] STORAGE-FILE\n",
+    fprintf(stderr, "Syntax: %s [-v] [-F PREFETCH-AHEAD] [-L] "
+	    "[-O ORPHAN-TIMEOUT] [-p ERROR PREFIX] [-Q] [-R] [-s] "
+	    "STORAGE-FILE\n",
 	    error_get_program_name());
 
     exit(-SYNTAX_ERROR);
@@ -44,51 +45,86 @@ static void show_syntax(void)
 static status output_stg(double secs)
 {
     if (printf("\"%.20s\", STG.REC/s: %.2f, STG.MIN/us: %.2f, "
-	       "STG.AVG/us: %.2f, STG.MAX/us: %.2f, STG.STD/us: %.2f "
-	       "[%c]%s",
+	       "STG.AVG/us: %.2f, STG.MAX/us: %.2f, STG.STD/us: %.2f ",
 	       storage_get_description(store),
 	       latency_get_count(stg_latency) / secs,
 	       latency_get_min(stg_latency),
 	       latency_get_mean(stg_latency),
 	       latency_get_max(stg_latency),
-	       latency_get_stddev(stg_latency),
-	       event + (event > 9 ? 'A' - 10 : '0'),
+	       latency_get_stddev(stg_latency)) < 0)
+	return error_errno("output_stg: printf");
+
+    /* NB. a traced storage's latency is broken down into that from the
+       origin of a value to its arrival here, and thence to its reading */
+    if (org_latency &&
+	printf("ORG.AVG/us: %.2f, ORG.P99/us: %.2f, "
+	       "E2E.AVG/us: %.2f, E2E.P99/us: %.2f, E2E.MAX/us: %.2f ",
+	       latency_get_mean(org_latency),
+	       latency_get_percentile(org_latency, 99),
+	       latency_get_mean(e2e_latency),
+	       latency_get_percentile(e2e_latency, 99),
+	       latency_get_max(e2e_latency)) < 0)
+	return error_errno("output_stg: printf");
+
+    if (printf("[%c]%s", event + (event > 9 ? 'A' - 10 : '0'),
 	       (isatty(STDOUT_FILENO) ? "\033[K\r" : "\n")) < 0)
 	return error_errno("output_stg: printf");
 
     return OK;
 }
 
+static status roll_stg(void)
+{
+    status st;
+    if (FAILED(st = latency_roll(stg_latency)) ||
+	(org_latency &&
+	 (FAILED(st = latency_roll(org_latency)) ||
+	  FAILED(st = latency_roll(e2e_latency)))))
+	return st;
+
+    return OK;
+}
+
 static status update(q_index qi)
 {
     record_handle rec = NULL;
     identifier id;
-    microsec now, when;
-    struct datum *d;
-    revision rev;
+    microsec now, when, origin;
+    struct datum d;
     long xyz;
     status st;
 
     if (FAILED(st = signal_any_raised()) ||
 	FAILED(st = storage_read_queue(store, qi, &id)) ||
-	FAILED(st = storage_get_record(store, id, &rec)))
+	FAILED(st = storage_get_record(store, id, &rec)) ||
+	FAILED(st = storage_read_value(store, rec, &d, sizeof(d),
+				       NULL, &when)))
 	return st;
 
-    d = record_get_value_ref(rec);
-    do {
-	if (FAILED(st = record_read_lock(rec, &rev)))
-	    return st;
-
-	xyz = d->xyz;
-	when = record_get_timestamp(rec);
-    } while (rev != record_get_revision(rec));
+    xyz = d.xyz;
 
     event |= DATA_UPDATED;
     if (qi > xyz)
 	event |= DATA_SKIPPED;
 
-    if (stg_latency && !FAILED(st = clock_time(&now)))
-	st = latency_on_sample(stg_latency, now - when);
+    if (!stg_latency || FAILED(st = storage_time_now(store, &now)))
+	return st;
+
+    if (storage_get_flags(store) & STORAGE_NANOSEC)
+	when /= 1000;
+
+    if (FAILED(st = latency_on_sample(stg_latency, now - when)))
+	return st;
+
+    if (org_latency) {
+	origin = storage_get_origin_time(store, rec);
+	if (storage_get_flags(store) & STORAGE_NANOSEC)
+	    origin /= 1000;
+
+	if (FAILED(st = latency_on_sample(org_latency, when - origin)) ||
+	    FAILED(st = latency_on_sample(e2e_latency, now - origin)))
+	    return st;
+    }
 
     return st;
 }
@@ -98,6 +134,7 @@ int main(int argc, char *argv[])
     status st = OK;
     size_t q_capacity;
     long old_head;
+    size_t prefetch_ahead = DEFAULT_PREFETCH_AHEAD;
     boolean stg_stats = FALSE, ignore_recreate = FALSE, ignore_overrun = FALSE;
     microsec last_print, created_time, delay,
 	orphan_timeout = DEFAULT_ORPHAN_TIMEOUT_USEC;
@@ -107,8 +144,12 @@ int main(int argc, char *argv[])
     strcpy(prog_name, argv[0]);
     error_set_program_name(prog_name);
 
-    while ((opt = getopt(argc, argv, "LO:p:QRsv")) != -1)
+    while ((opt = getopt(argc, argv, "F:LO:p:QRsv")) != -1)
 	switch (opt) {
+	case 'F':
+	    if (FAILED(a2i(optarg, "%lu", &prefetch_ahead)))
+		error_report_fatal();
+	    break;
 	case 'L':
 	    error_with_timestamp(TRUE);
 	    break;
@@ -147,6 +188,9 @@ int main(int argc, char *argv[])
 	(!ignore_recreate &&
 	 FAILED(storage_get_created_time(store, &created_time))) ||
 	(stg_stats && FAILED(latency_create(&stg_latency))) ||
+	(stg_stats && (storage_get_flags(store) & STORAGE_TRACED) &&
+	 (FAILED(latency_create(&org_latency)) ||
+	  FAILED(latency_create(&e2e_latency)))) ||
 	FAILED(clock_time(&last_print)))
 	error_report_fatal();
 
@@ -167,7 +211,8 @@ int main(int argc, char *argv[])
 
     for (;;) {
 	microsec now, when;
-	q_index q, new_head = storage_get_queue_head(store);
+	q_index q, new_head = storage_get_queue_head(store),
+	    ahead = (q_index)prefetch_ahead;
 
 	if (new_head == old_head) {
 	    if (FAILED(st = clock_sleep(1)))
@@ -185,9 +230,17 @@ int main(int argc, char *argv[])
 		}
 	    }
 
-	    for (q = old_head; q < new_head; ++q)
+	    /* NB. prefetch records ahead, so their cache misses overlap */
+	    for (q = old_head; q < new_head && q < old_head + ahead; ++q)
+		storage_prefetch_queue(store, q);
+
+	    for (q = old_head; q < new_head; ++q) {
+		if (ahead && q + ahead < new_head)
+		    storage_prefetch_queue(store, q + ahead);
+
 		if (FAILED(st = update(q)))
 		    goto finish;
+	    }
 
 	    old_head = new_head;
 	}
@@ -219,7 +272,7 @@ int main(int argc, char *argv[])
 	if ((now - last_print) >= delay) {
 	    if (stg_stats) {
 		if (FAILED(st = output_stg((now - last_print) / 1000000.0)) ||
-		    FAILED(st = latency_roll(stg_latency)))
+		    FAILED(st = roll_stg()))
 		    break;
 	    } else
 		putchar(event + (event > 9 ? 'A' - 10 : '0'));
@@ -236,6 +289,8 @@ finish:
     if (FAILED(st) ||
 	FAILED(storage_destroy(&store)) ||
 	(stg_stats && FAILED(latency_destroy(&stg_latency))) ||
+	FAILED(latency_destroy(&org_latency)) ||
+	FAILED(latency_destroy(&e2e_latency)) ||
 	FAILED(signal_remove_handler(SIGHUP)) ||
 	FAILED(signal_remove_handler(SIGINT)) ||
 	FAILED(signal_remove_handler(SIGTERM)))
@@ -8,6 +8,7 @@
 #include <lancaster/error.h>
 #include <lancaster/h2n2h.h>
 #include <lancaster/latency.h>
+#include <lancaster/pagedir.h>
 #include <lancaster/poller.h>
 #include <lancaster/receiver.h>
 #include <lancaster/sequence.h>
@@ -53,11 +54,20 @@ struct receiver {
     sock_handle mcast_sock;
     sock_handle tcp_sock;
     sock_addr_handle tcp_addr;
-    sequence *record_seqs;
+    pagedir_handle record_seqs;
     sequence next_seq;
     size_t mcast_mtu;
     identifier base_id;
     size_t val_size;
+    boolean has_lengths;
+    boolean is_nanosec;
+    size_t origin_size;
+    size_t frag_size;
+    char *frag_buf;
+    identifier frag_id;
+    sequence frag_seq;
+    size_t frag_done;
+    size_t frag_total;
     char *in_buf;
     char *in_next;
     size_t in_todo;
@@ -73,8 +83,8 @@ struct receiver {
     sock_addr_handle mcast_pub_addr;
     latency_handle mcast_latency;
     struct receiver_stats *curr_stats;
-    struct receiver_stats *next_stats;
-    volatile spin_lock stats_lock;
+    struct receiver_stats *last_stats;
+    volatile struct receiver_stats *total_stats;
     volatile boolean is_stopping;
 #if defined(DEBUG_PROTOCOL)
     FILE *debug_file;
@@ -97,33 +107,40 @@ static const char *debug_time(void)
 
 static status update_stats(receiver_handle recv, size_t pkt_sz, microsec delay)
 {
-    status st;
-    if (FAILED(st = spin_write_lock(&recv->stats_lock, NULL)))
-	return st;
-
-    recv->next_stats->mcast_bytes_recv += pkt_sz;
-    spin_unlock(&recv->stats_lock, 0);
-
+    recv->total_stats->mcast_bytes_recv += pkt_sz;
     return latency_on_sample(recv->mcast_latency, delay);
 }
 
 static status update_record(receiver_handle recv, sequence seq, identifier id,
-			    void *new_val, microsec when)
+			    void *new_val, size_t val_len, microsec when,
+			    microsec origin)
 {
     status st;
     revision rev;
+    sequence *pseq;
     record_handle rec = NULL;
 
     if (FAILED(st = storage_get_record(recv->store, id, &rec)) ||
 	FAILED(st = record_write_lock(rec, &rev)))
 	return st;
 
-    memcpy(record_get_value_ref(rec), new_val, recv->val_size);
+    pseq = pagedir_get(recv->record_seqs, id - recv->base_id);
+    if (!pseq) {
+	record_set_revision(rec, rev);
+	return NO_MEMORY;
+    }
+
+    if (FAILED(st = storage_store_value2(recv->store, rec, new_val, val_len,
+					when, (recv->origin_size > 0
+					       ? origin : when),
+					NEXT_REV(rev)))) {
+	record_set_revision(rec, rev);
+	return st;
+    }
 
-    record_set_timestamp(rec, when);
     record_set_revision(rec, NEXT_REV(rev));
 
-    recv->record_seqs[id - recv->base_id] = seq;
+    *pseq = seq;
     if (storage_get_queue_capacity(recv->store) > 0 &&
 	FAILED(st = storage_write_queue(recv->store, id)))
 	return st;
@@ -133,7 +150,8 @@ static status update_record(receiver_handle recv, sequence seq, identifier id,
 	    "%s       updating seq %07ld, id #%07ld, rev %07ld, ",
 	    debug_time(), seq, id, NEXT_REV(rev));
 
-    fdump(record_get_value_ref(rec), NULL, 16, recv->debug_file);
+    fdump(storage_get_value_ref(recv->store, rec), NULL, 16,
+	  recv->debug_file);
 #endif
     return st;
 }
@@ -143,6 +161,15 @@ static status request_gap(receiver_handle recv, sequence low, sequence high)
     struct sequence_range *r = (struct sequence_range *)recv->out_buf;
     status st;
 
+    /* NB. widen a request not yet begun to be sent */
+    if (recv->out_todo > 0 && recv->out_next == recv->out_buf) {
+	if ((sequence)ntohll(r->low) < low)
+	    low = ntohll(r->low);
+
+	if ((sequence)ntohll(r->high) > high)
+	    high = ntohll(r->high);
+    }
+
     r->low = htonll(low);
     r->high = htonll(high);
 
@@ -150,12 +177,10 @@ static status request_gap(receiver_handle recv, sequence low, sequence high)
     recv->out_todo = sizeof(struct sequence_range);
 
     if (FAILED(st = poller_set_event(recv->poller, recv->tcp_sock,
-				     POLLIN | POLLOUT)) ||
-	FAILED(st = spin_write_lock(&recv->stats_lock, NULL)))
+				     POLLIN | POLLOUT)))
 	return st;
 
-    ++recv->next_stats->tcp_gap_count;
-    spin_unlock(&recv->stats_lock, 0);
+    ++recv->total_stats->tcp_gap_count;
 
 #if defined(DEBUG_PROTOCOL)
     fprintf(recv->debug_file, "%s   tcp gap request seq %07ld --> %07ld\n",
@@ -164,10 +189,63 @@ static status request_gap(receiver_handle recv, sequence low, sequence high)
     return st;
 }
 
+static status abandon_fragments(receiver_handle recv)
+{
+    if (recv->frag_total == 0)
+	return OK;
+
+#if defined(DEBUG_PROTOCOL)
+    fprintf(recv->debug_file,
+	    "%s       abandoning seq %07ld, id #%07ld, %lu of %lu bytes\n",
+	    debug_time(), recv->frag_seq, recv->frag_id,
+	    (unsigned long)recv->frag_done, (unsigned long)recv->frag_total);
+#endif
+
+    /* NB. the sender recovers the whole value by its first sequence */
+    recv->frag_total = 0;
+    return request_gap(recv, recv->frag_seq, recv->frag_seq + 1);
+}
+
+static status update_fragment(receiver_handle recv, sequence seq,
+			      identifier id, size_t offset, size_t total,
+			      void *frag, size_t frag_len, microsec when,
+			      microsec origin)
+{
+    status st;
+    if (offset == 0) {
+	if (FAILED(st = abandon_fragments(recv)))
+	    return st;
+
+	recv->frag_id = id;
+	recv->frag_seq = seq;
+	recv->frag_done = 0;
+	recv->frag_total = total;
+    } else if (recv->frag_total == 0 || id != recv->frag_id ||
+	       offset != recv->frag_done || total != recv->frag_total) {
+	/* NB. the first fragment of this value was lost */
+	sequence first_seq = seq - offset / recv->frag_size;
+	if (FAILED(st = abandon_fragments(recv)))
+	    return st;
+
+	return request_gap(recv, first_seq, first_seq + 1);
+    }
+
+    memcpy(recv->frag_buf + offset, frag, frag_len);
+    recv->frag_done += frag_len;
+
+    if (recv->frag_done < recv->frag_total)
+	return OK;
+
+    recv->frag_total = 0;
+    return update_record(recv, recv->frag_seq, id, recv->frag_buf,
+			 total, when, origin);
+}
+
 static status mcast_on_read(receiver_handle recv)
 {
     status st, st2;
-    microsec now;
+    microsec now, stamp, delay;
+    nanosec now_ns;
     boolean is_hb;
     unsigned long mcast_ip, tcp_ip;
 
@@ -177,9 +255,12 @@ static status mcast_on_read(receiver_handle recv)
 
     if (FAILED(st = st2 = sock_recvfrom(recv->mcast_sock, recv->mcast_src_addr,
 					buf, recv->mcast_mtu)) ||
-	FAILED(st = clock_time(&now)))
+	FAILED(st = clock_time_ns(&now_ns)))
 	return st;
 
+    now = now_ns / 1000;
+    stamp = (recv->is_nanosec ? now_ns : now);
+
     if ((size_t)st2 < (sizeof(sequence) + sizeof(microsec)))
 	return error_msg(PROTOCOL_ERROR, "mcast_on_read: packet truncated");
 
@@ -213,8 +294,13 @@ static status mcast_on_read(receiver_handle recv)
 #endif
     }
 
+    /* NB. a nanosecond storage's packets are stamped in nanoseconds */
+    delay = (recv->is_nanosec
+	     ? (now_ns - (nanosec)ntohll(*in_stamp_ref)) / 1000
+	     : now - (microsec)ntohll(*in_stamp_ref));
+
     recv->mcast_recv_time = now;
-    if (FAILED(st = update_stats(recv, st2, now - ntohll(*in_stamp_ref))))
+    if (FAILED(st = update_stats(recv, st2, delay)))
 	return st;
 
     *in_seq_ref = ntohll(*in_seq_ref);
@@ -239,11 +325,78 @@ static status mcast_on_read(receiver_handle recv)
 	p = buf + sizeof(sequence) + sizeof(microsec);
 	last = buf + st2;
 
-	for (; p < last; p += sizeof(identifier) + recv->val_size) {
+	while (p < last) {
 	    identifier *id = (identifier *)p;
-	    if (FAILED(st = update_record(recv, *in_seq_ref,
-					  ntohll(*id), id + 1, now)))
+	    size_t val_len = recv->val_size;
+	    microsec origin = 0;
+
+	    /* NB. a datagram may be truncated or malformed: check that each
+	       header lies within it before reading it */
+	    if ((size_t)(last - p) < sizeof(identifier) + recv->origin_size)
+		return error_msg(PROTOCOL_ERROR,
+				 "mcast_on_read: record truncated");
+
+	    p += sizeof(identifier);
+
+	    if (recv->origin_size > 0) {
+		origin = ntohll(*(microsec *)p);
+		p += recv->origin_size;
+	    }
+
+	    if (recv->has_lengths) {
+		if ((size_t)(last - p) < sizeof(uint32_t))
+		    return error_msg(PROTOCOL_ERROR,
+				     "mcast_on_read: record truncated");
+
+		val_len = ntohl(*(uint32_t *)p);
+		p += sizeof(uint32_t);
+
+		if (val_len & FRAGMENT_FLAG) {
+		    uint32_t *hdr = (uint32_t *)p;
+		    size_t offset, total;
+
+		    if ((size_t)(last - p) < 2 * sizeof(uint32_t))
+			return error_msg(PROTOCOL_ERROR,
+					 "mcast_on_read: fragment truncated");
+
+		    offset = ntohl(hdr[0]);
+		    total = ntohl(hdr[1]);
+
+		    val_len &= ~FRAGMENT_FLAG;
+		    p += 2 * sizeof(uint32_t);
+
+		    if (total > recv->val_size || offset > total ||
+			val_len > total - offset ||
+			val_len > (size_t)(last - p))
+			return error_msg(PROTOCOL_ERROR,
+					 "mcast_on_read: invalid fragment");
+
+		    if (FAILED(st = update_fragment(recv, *in_seq_ref,
+						    ntohll(*id), offset,
+						    total, p, val_len, stamp,
+						    origin)))
+			return st;
+
+		    p += val_len;
+		    continue;
+		}
+
+		if (val_len > recv->val_size)
+		    return error_msg(PROTOCOL_ERROR,
+				     "mcast_on_read: invalid value length");
+	    }
+
+	    if (val_len > (size_t)(last - p))
+		return error_msg(PROTOCOL_ERROR,
+				 "mcast_on_read: record truncated");
+
+	    if (FAILED(st = abandon_fragments(recv)) ||
+		FAILED(st = update_record(recv, *in_seq_ref,
+					  ntohll(*id), p, val_len, stamp,
+					  origin)))
 		return st;
+
+	    p += val_len;
 	}
 
 	is_hb = FALSE;
@@ -279,12 +432,10 @@ static status tcp_read_buf(receiver_handle recv)
 
     if (recv_sz > 0) {
 	status st2;
-	if (FAILED(st2 = clock_time(&recv->tcp_recv_time)) ||
-	    FAILED(st2 = spin_write_lock(&recv->stats_lock, NULL)))
+	if (FAILED(st2 = clock_time_coarse(&recv->tcp_recv_time)))
 	    return st2;
 
-	recv->next_stats->tcp_bytes_recv += recv_sz;
-	spin_unlock(&recv->stats_lock, 0);
+	recv->total_stats->tcp_bytes_recv += recv_sz;
     }
 #if defined(DEBUG_PROTOCOL)
     fprintf(recv->debug_file, "%s   tcp recv %lu bytes\n",
@@ -369,22 +520,55 @@ static status tcp_on_read(receiver_handle recv)
 		return st;
 	    }
 
-	    recv->in_todo = sizeof(identifier) + recv->val_size;
+	    recv->in_todo = sizeof(identifier) + recv->origin_size +
+		recv->val_size + (recv->has_lengths ? sizeof(uint32_t) : 0);
 	    return OK;
 	}
 
 	*id = ntohll(*id);
 
+	if ((size_t)(*id - recv->base_id) >=
+	    pagedir_get_count(recv->record_seqs))
+	    return error_msg(PROTOCOL_ERROR,
+			     "tcp_on_read: invalid identifier");
+
 #if defined(DEBUG_PROTOCOL)
 	fprintf(recv->debug_file,
 		"%s     tcp gap reply seq %07ld, id #%07ld\n",
 		debug_time(), *in_seq_ref, *id);
 #endif
-	if (*in_seq_ref > recv->record_seqs[*id - recv->base_id]) {
-	    microsec now;
-	    if (FAILED(st = clock_time(&now)) ||
+	if (*in_seq_ref > *(const sequence *)
+	    pagedir_lookup(recv->record_seqs, *id - recv->base_id)) {
+	    microsec now, origin = 0;
+	    char *val = (char *)(id + 1);
+	    size_t val_len = recv->val_size;
+
+	    /* NB. a reply is read whole, but check its headers as for a
+	       datagram, in case its expected size and layout disagree */
+	    if ((size_t)(recv->in_next - val) < recv->origin_size +
+		(recv->has_lengths ? sizeof(uint32_t) : 0))
+		return error_msg(PROTOCOL_ERROR,
+				 "tcp_on_read: reply truncated");
+
+	    if (recv->origin_size > 0) {
+		origin = ntohll(*(microsec *)val);
+		val += recv->origin_size;
+	    }
+
+	    if (recv->has_lengths) {
+		val_len = ntohl(*(uint32_t *)val);
+		val += sizeof(uint32_t);
+
+		if (val_len > recv->val_size)
+		    return error_msg(PROTOCOL_ERROR,
+				     "tcp_on_read: invalid value length");
+	    }
+
+	    if (FAILED(st = (recv->is_nanosec
+			     ? storage_time_now_ns(recv->store, &now)
+			     : storage_time_now(recv->store, &now))) ||
 		FAILED(st = update_record(recv, *in_seq_ref,
-					  *id, id + 1, now)))
+					  *id, val, val_len, now, origin)))
 		return st;
 	}
 
@@ -423,29 +607,34 @@ static status init(receiver_handle *precv, const char *mmap_file,
     sock_addr_handle bind_addr = NULL, iface_addr = NULL;
     char buf[512], mcast_address[32];
     unsigned wire_ver, data_ver;
+    struct storage_options opts;
+    sequence blank_seq = -1;
     int wire_ver_len, mcast_port, proto_len;
     identifier base_id, max_id;
     microsec hb_usec, max_age_usec;
     unsigned long mcast_mtu, val_size, pub_q_capacity;
-    size_t rec_seq_sz;
     status st, st2;
 #if defined(DEBUG_PROTOCOL)
     char debug_name[256];
 #endif
 
     BZERO(*precv);
+    BZERO(&opts);
 
     (*precv)->curr_stats = XMALLOC(struct receiver_stats);
     if (!(*precv)->curr_stats)
 	return NO_MEMORY;
 
-    (*precv)->next_stats = XMALLOC(struct receiver_stats);
-    if (!(*precv)->next_stats)
+    (*precv)->last_stats = XMALLOC(struct receiver_stats);
+    if (!(*precv)->last_stats)
+	return NO_MEMORY;
+
+    (*precv)->total_stats = xcalloc(1, sizeof(struct receiver_stats));
+    if (!(*precv)->total_stats)
 	return NO_MEMORY;
 
     BZERO((*precv)->curr_stats);
-    BZERO((*precv)->next_stats);
-    spin_create(&(*precv)->stats_lock);
+    BZERO((*precv)->last_stats);
 
     if (FAILED(st = latency_create(&(*precv)->mcast_latency)) ||
 	FAILED(st = sock_create(&(*precv)->tcp_sock, SOCK_STREAM, 0)) ||
@@ -489,12 +678,12 @@ static status init(receiver_handle *precv, const char *mmap_file,
 
     st = sscanf(buf + wire_ver_len,
 		"%u %31s %d %lu %" SCNd64 " %" SCNd64
-		" %lu %lu %" SCNd64 " %" SCNd64 " %n",
+		" %lu %lu %" SCNd64 " %" SCNd64 " %u %n",
 		&data_ver, mcast_address, &mcast_port, &mcast_mtu, &base_id,
 		&max_id, &val_size, &pub_q_capacity, &max_age_usec, &hb_usec,
-		&proto_len);
+		&opts.flags, &proto_len);
 
-    if (st != 10)
+    if (st != 11)
 	return error_msg(PROTOCOL_ERROR,
 			 "receiver_create: invalid publisher attributes:\n%s",
 			 buf);
@@ -506,6 +695,20 @@ static status init(receiver_handle *precv, const char *mmap_file,
     (*precv)->mcast_mtu = (size_t)mcast_mtu;
     (*precv)->base_id = base_id;
     (*precv)->val_size = (size_t)val_size;
+    (*precv)->is_nanosec = ((opts.flags & STORAGE_NANOSEC) != 0);
+    (*precv)->origin_size =
+	((opts.flags & STORAGE_TRACED) ? sizeof(microsec) : 0);
+    (*precv)->has_lengths =
+	(opts.flags & STORAGE_VARLEN) ||
+	mcast_mtu < (sizeof(sequence) + sizeof(microsec) +
+		     sizeof(identifier) + (*precv)->origin_size + val_size);
+
+    if (mcast_mtu <= FRAGMENT_OVERHEAD)
+	return error_msg(PROTOCOL_ERROR,
+			 "receiver_create: invalid publisher MTU");
+
+    (*precv)->frag_size =
+	(size_t)mcast_mtu - FRAGMENT_OVERHEAD - (*precv)->origin_size;
     (*precv)->next_seq = 0;
     (*precv)->touched_time = 0;
     (*precv)->touch_period_usec = touch_period_usec;
@@ -515,11 +718,19 @@ static status init(receiver_handle *precv, const char *mmap_file,
 	q_capacity = (size_t)pub_q_capacity;
 
     (*precv)->in_buf =
-	xmalloc(sizeof(sequence) + sizeof(identifier) + (*precv)->val_size);
+	xmalloc(sizeof(sequence) + sizeof(identifier) +
+		(*precv)->origin_size + (*precv)->val_size +
+		((*precv)->has_lengths ? sizeof(uint32_t) : 0));
 
     if (!(*precv)->in_buf)
 	return NO_MEMORY;
 
+    if ((*precv)->has_lengths) {
+	(*precv)->frag_buf = xmalloc((*precv)->val_size);
+	if (!(*precv)->frag_buf)
+	    return NO_MEMORY;
+    }
+
     (*precv)->out_buf = XMALLOC(struct sequence_range);
     if (!(*precv)->out_buf)
 	return NO_MEMORY;
@@ -527,17 +738,14 @@ static status init(receiver_handle *precv, const char *mmap_file,
     (*precv)->in_next = (*precv)->in_buf;
     (*precv)->in_todo = sizeof(sequence);
 
-    rec_seq_sz = (max_id - base_id) * sizeof(sequence);
-    (*precv)->record_seqs = xmalloc(rec_seq_sz);
-    if (!(*precv)->record_seqs)
-	return NO_MEMORY;
-
-    memset((*precv)->record_seqs, -1, rec_seq_sz);
+    if (FAILED(st = pagedir_create(&(*precv)->record_seqs, sizeof(sequence),
+				   max_id - base_id, &blank_seq)))
+	return st;
 
-    if (!FAILED(st = storage_create(&(*precv)->store, mmap_file,
-				    O_RDWR | O_CREAT, mode_flags, TRUE,
-				    base_id, max_id, val_size, property_size,
-				    q_capacity, buf + proto_len)) &&
+    if (!FAILED(st = storage_create2(&(*precv)->store, mmap_file,
+				     O_RDWR | O_CREAT, mode_flags, TRUE,
+				     base_id, max_id, val_size, property_size,
+				     q_capacity, buf + proto_len, &opts)) &&
 	!FAILED(st = storage_set_data_version((*precv)->store, data_ver)) &&
 	!FAILED(st = sock_create(&(*precv)->mcast_sock, SOCK_DGRAM, 0)) &&
 	!FAILED(st = sock_set_rx_buf((*precv)->mcast_sock, UDP_RX_BUFSIZ)) &&
@@ -566,7 +774,7 @@ static status init(receiver_handle *precv, const char *mmap_file,
 				(*precv)->mcast_sock, POLLIN)) &&
 	!FAILED(st = poller_add((*precv)->poller,
 				(*precv)->tcp_sock, POLLIN)) &&
-	!FAILED(st = clock_time(&(*precv)->mcast_recv_time))) {
+	!FAILED(st = clock_time_coarse(&(*precv)->mcast_recv_time))) {
 	(*precv)->tcp_recv_time = (*precv)->mcast_recv_time;
 
 #if defined(DEBUG_PROTOCOL)
@@ -625,12 +833,14 @@ status receiver_destroy(receiver_handle *precv)
 	FAILED(st = sock_addr_destroy(&(*precv)->mcast_src_addr)) ||
 	FAILED(st = sock_addr_destroy(&(*precv)->mcast_pub_addr)) ||
 	FAILED(st = storage_destroy(&(*precv)->store)) ||
+	FAILED(st = pagedir_destroy(&(*precv)->record_seqs)) ||
 	FAILED(st = latency_destroy(&(*precv)->mcast_latency)))
 	return st;
 
-    xfree((*precv)->next_stats);
+    xfree((*precv)->frag_buf);
+    xfree((void *)(*precv)->total_stats);
+    xfree((*precv)->last_stats);
     xfree((*precv)->curr_stats);
-    xfree((*precv)->record_seqs);
     xfree((*precv)->out_buf);
     xfree((*precv)->in_buf);
 
@@ -662,7 +872,7 @@ status receiver_run(receiver_handle recv)
 	    (st > 0 &&
              FAILED(st = poller_process_events(recv->poller,
                                                event_func, recv))) ||
-	    FAILED(st = clock_time(&now)) ||
+	    FAILED(st = clock_time_coarse(&now)) ||
 	    (recv->touch_period_usec > 0 &&
 	     (now - recv->touched_time) >= recv->touch_period_usec &&
 	     FAILED(st = storage_touch(recv->store,
@@ -739,19 +949,46 @@ double receiver_get_mcast_stddev_latency(receiver_handle recv)
     return latency_get_stddev(recv->mcast_latency);
 }
 
+double receiver_get_mcast_percentile_latency(receiver_handle recv,
+					     double pct)
+{
+    return latency_get_percentile(recv->mcast_latency, pct);
+}
+
+long receiver_get_total_tcp_gap_count(receiver_handle recv)
+{
+    return recv->total_stats->tcp_gap_count;
+}
+
+long receiver_get_total_tcp_bytes_recv(receiver_handle recv)
+{
+    return recv->total_stats->tcp_bytes_recv;
+}
+
+long receiver_get_total_mcast_bytes_recv(receiver_handle recv)
+{
+    return recv->total_stats->mcast_bytes_recv;
+}
+
+long receiver_get_total_mcast_packets_recv(receiver_handle recv)
+{
+    return latency_get_total_count(recv->mcast_latency);
+}
+
 status receiver_roll_stats(receiver_handle recv)
 {
-    status st;
-    struct receiver_stats *tmp;
-    if (FAILED(st = spin_write_lock(&recv->stats_lock, NULL)))
-	return st;
+    struct receiver_stats total;
 
-    tmp = recv->next_stats;
-    recv->next_stats = recv->curr_stats;
-    recv->curr_stats = tmp;
+    /* NB. only the receiving thread writes the totals */
+    total = *recv->total_stats;
 
-    BZERO(recv->next_stats);
-    spin_unlock(&recv->stats_lock, 0);
+    recv->curr_stats->tcp_gap_count =
+	total.tcp_gap_count - recv->last_stats->tcp_gap_count;
+    recv->curr_stats->tcp_bytes_recv =
+	total.tcp_bytes_recv - recv->last_stats->tcp_bytes_recv;
+    recv->curr_stats->mcast_bytes_recv =
+	total.mcast_bytes_recv - recv->last_stats->mcast_bytes_recv;
 
+    *recv->last_stats = total;
     return latency_roll(recv->mcast_latency);
 }
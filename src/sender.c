@@ -7,11 +7,13 @@
 #include <lancaster/error.h>
 #include <lancaster/h2n2h.h>
 #include <lancaster/latency.h>
+#include <lancaster/pagedir.h>
 #include <lancaster/poller.h>
 #include <lancaster/sender.h>
 #include <lancaster/sequence.h>
 #include <lancaster/signals.h>
 #include <lancaster/spin.h>
+#include <lancaster/storage_inline.h>
 #include <lancaster/version.h>
 #include <lancaster/xalloc.h>
 #include <errno.h>
@@ -43,6 +45,11 @@ struct sender_stats {
     long mcast_packets_sent;
 };
 
+struct record_state {
+    revision rev;
+    sequence seq;
+};
+
 struct sender {
     sock_handle listen_sock;
     sock_addr_handle listen_addr;
@@ -54,14 +61,21 @@ struct sender {
     identifier max_id;
     size_t val_size;
     size_t client_count;
-    revision *record_revs;
-    sequence *record_seqs;
+    boolean has_lengths;
+    boolean is_lock_free;
+    boolean is_nanosec;
+    size_t origin_size;
+    char *val_buf;
+    size_t frag_size;
+    pagedir_handle record_states;
     sequence next_seq;
     sequence min_seq;
     boolean ignore_recreate;
     boolean ignore_overrun;
+    size_t prefetch_ahead;
     microsec store_created_time;
     microsec mcast_insert_time;
+    microsec mcast_begin_time;
     microsec mcast_send_time;
     microsec last_active_time;
     microsec heartbeat_usec;
@@ -72,9 +86,10 @@ struct sender {
     char *pkt_next;
     q_index last_q_idx;
     latency_handle stg_latency;
+    latency_handle pkt_latency;
     struct sender_stats *curr_stats;
-    struct sender_stats *next_stats;
-    volatile spin_lock stats_lock;
+    struct sender_stats *last_stats;
+    volatile struct sender_stats *total_stats;
     volatile boolean is_stopping;
     char hello_str[128];
 #if defined(DEBUG_PROTOCOL) || defined(DEBUG_GAPS)
@@ -108,8 +123,11 @@ struct tcp_client {
 
 #define CLIENT_SEQ(clnt) (*((sequence *)clnt->out_buf))
 #define CLIENT_ID(clnt) (*(identifier *)(clnt->out_buf + sizeof(sequence)))
+#define CLIENT_ORIGIN(clnt)						\
+    (*(microsec *)(clnt->out_buf + sizeof(sequence) + sizeof(identifier)))
 #define CLIENT_VAL(clnt) ((void *)(clnt->out_buf + sizeof(sequence)	\
-				   + sizeof(identifier)))
+				   + sizeof(identifier)			\
+				   + clnt->sndr->origin_size))
 
 #if defined(DEBUG_PROTOCOL) || defined(DEBUG_GAPS)
 static const char *debug_time(void)
@@ -129,12 +147,15 @@ static status mcast_send_pkt(sender_handle sndr)
 {
     status st, st2;
     microsec now;
+    nanosec stamp;
     sequence seq;
 
-    if (FAILED(st = clock_time(&now)))
+    /* NB. a nanosecond storage's packets are stamped in nanoseconds */
+    if (FAILED(st = clock_time_ns(&stamp)))
 	return st;
 
-    SENDER_USEC(sndr) = htonll(now);
+    now = stamp / 1000;
+    SENDER_USEC(sndr) = htonll(sndr->is_nanosec ? stamp : now);
 
     if (FAILED(st2 = sock_sendto(sndr->mcast_sock,
 				 sndr->sendto_addr, sndr->pkt_buf,
@@ -144,6 +165,15 @@ static status mcast_send_pkt(sender_handle sndr)
     sndr->last_active_time = sndr->mcast_send_time = now;
     seq = ntohll(SENDER_SEQ(sndr));
 
+    /* NB. how long the packet's first record waited for it to be sent */
+    if (sndr->mcast_begin_time != 0) {
+	if (FAILED(st = latency_on_sample(sndr->pkt_latency,
+					  now - sndr->mcast_begin_time)))
+	    return st;
+
+	sndr->mcast_begin_time = 0;
+    }
+
     if (seq >= 0 && ++sndr->next_seq == SEQUENCE_MAX)
 	return error_msg(SEQUENCE_OVERFLOW,
 			 "mcast_send_pkt: sequence overflow");
@@ -156,45 +186,164 @@ static status mcast_send_pkt(sender_handle sndr)
     sndr->pkt_next = sndr->pkt_buf;
     sndr->mcast_insert_time = 0;
 
-    if (FAILED(st = spin_write_lock(&sndr->stats_lock, NULL)))
+    sndr->total_stats->mcast_bytes_sent += st2;
+    ++sndr->total_stats->mcast_packets_sent;
+    return st;
+}
+
+static status copy_value(sender_handle sndr, record_handle rec,
+			 revision *prev, void *to, size_t *plen, microsec *pwhen,
+			 microsec *porigin)
+{
+    status st;
+    if (sndr->is_lock_free) {
+	/* NB. the revision read earlier is superseded by that of the value */
+	*plen = sndr->val_size;
+	if (FAILED(st = storage_read_value(sndr->store, rec, to,
+					   sndr->val_size, prev, pwhen)))
+	    return st;
+
+	/* NB. the origin may be that of a later revision than the value */
+	if (porigin)
+	    *porigin = storage_get_origin_time(sndr->store, rec);
+
 	return st;
+    }
 
-    sndr->next_stats->mcast_bytes_sent += st2;
-    ++sndr->next_stats->mcast_packets_sent;
+    for (;;) {
+	size_t len = storage_get_value_length(sndr->store, rec);
+	storage_copy_value(to, record_get_value_ref(rec), len);
 
-    spin_unlock(&sndr->stats_lock, 0);
-    return st;
+	if (pwhen)
+	    *pwhen = record_get_timestamp(rec);
+
+	if (porigin)
+	    *porigin = storage_get_origin_time(sndr->store, rec);
+
+	if (*prev == record_get_revision(rec)) {
+	    *plen = len;
+	    return OK;
+	}
+
+	if (FAILED(st = record_read_lock(rec, prev)))
+	    return st;
+    }
+}
+
+static status mcast_send_fragments(sender_handle sndr, identifier id,
+				   size_t val_len, microsec origin)
+{
+    status st;
+    size_t offset = 0;
+
+    if (sndr->pkt_next != sndr->pkt_buf &&
+	FAILED(st = mcast_send_pkt(sndr)))
+	return st;
+
+    /* NB. every fragment but the last fills its packet, whose remaining
+       space may then be used by subsequent records */
+    for (;;) {
+	size_t frag_len = val_len - offset;
+	uint32_t *hdr;
+
+	if (frag_len > sndr->frag_size)
+	    frag_len = sndr->frag_size;
+
+	SENDER_SEQ(sndr) = htonll(sndr->next_seq);
+	sndr->pkt_next += sizeof(sequence) + sizeof(microsec);
+
+	SENDER_ID(sndr) = htonll(id);
+	sndr->pkt_next += sizeof(identifier);
+
+	if (sndr->origin_size > 0) {
+	    *(microsec *)sndr->pkt_next = htonll(origin);
+	    sndr->pkt_next += sndr->origin_size;
+	}
+
+	hdr = (uint32_t *)sndr->pkt_next;
+	hdr[0] = htonl((uint32_t)(FRAGMENT_FLAG | frag_len));
+	hdr[1] = htonl((uint32_t)offset);
+	hdr[2] = htonl((uint32_t)val_len);
+	sndr->pkt_next += 3 * sizeof(uint32_t);
+
+	memcpy(sndr->pkt_next, sndr->val_buf + offset, frag_len);
+	sndr->pkt_next += frag_len;
+
+	offset += frag_len;
+	if (offset == val_len)
+	    return OK;
+
+	if (FAILED(st = mcast_send_pkt(sndr))) {
+	    /* NB. the record will be sent afresh, in new fragments */
+	    sndr->pkt_next = sndr->pkt_buf;
+	    return st;
+	}
+    }
 }
 
 static status mcast_accum_record(sender_handle sndr, identifier id)
 {
     status st;
     revision rev;
-    microsec when;
+    microsec when, origin = 0;
+    microsec *porigin = (sndr->origin_size > 0 ? &origin : NULL);
     identifier idx = id - sndr->base_id;
     boolean sent_pkt = FALSE;
     record_handle rec = NULL;
-    size_t used_sz, avail_sz;
+    struct record_state *state;
+    size_t used_sz, avail_sz, rec_sz, val_len;
+    char *val_at;
 
     if (FAILED(st = storage_get_record(sndr->store, id, &rec)) ||
-	FAILED(st = record_read_lock(rec, &rev)))
+	FAILED(st = storage_read_value(sndr->store, rec, NULL, 0, &rev, NULL)))
 	return st;
 
-    if (rev == sndr->record_revs[idx]) {
+    if (rev == ((const struct record_state *)
+		pagedir_lookup(sndr->record_states, idx))->rev) {
 #if defined(DEBUG_PROTOCOL)
 	fprintf(sndr->debug_file,
 		"%s       skipping seq %07ld, id #%07ld, rev %07ld, ",
 		debug_time(), sndr->next_seq, id, rev);
 
-	fdump(record_get_value_ref(rec), NULL, 16, sndr->debug_file);
+	fdump(storage_get_value_ref(sndr->store, rec), NULL, 16,
+	      sndr->debug_file);
 #endif
 	return OK;
     }
 
+    state = pagedir_get(sndr->record_states, idx);
+    if (!state)
+	return NO_MEMORY;
+
+    if (sndr->has_lengths) {
+	/* NB. the value's length must be known before it is packed */
+	if (FAILED(st = copy_value(sndr, rec, &rev, sndr->val_buf,
+				   &val_len, &when, porigin)))
+	    return st;
+
+	rec_sz = sizeof(identifier) + sndr->origin_size +
+	    sizeof(uint32_t) + val_len;
+    } else
+	rec_sz = sizeof(identifier) + sndr->origin_size + sndr->val_size;
+
+    if (rec_sz > sndr->mcast_mtu - sizeof(sequence) - sizeof(microsec)) {
+	sequence first_seq = sndr->next_seq +
+	    (sndr->pkt_next != sndr->pkt_buf ? 1 : 0);
+
+	if (FAILED(st = mcast_send_fragments(sndr, id, val_len, origin)))
+	    return st;
+
+	/* NB. a gap in any fragment is recovered by the first's sequence */
+	state->rev = rev;
+	state->seq = first_seq;
+	sent_pkt = TRUE;
+	goto staged;
+    }
+
     used_sz = sndr->pkt_next - sndr->pkt_buf;
     avail_sz = sndr->mcast_mtu - used_sz;
 
-    if (avail_sz < (sizeof(identifier) + sndr->val_size)) {
+    if (avail_sz < rec_sz) {
 	if (FAILED(st = mcast_send_pkt(sndr)))
 	    return st;
 
@@ -209,34 +358,40 @@ static status mcast_accum_record(sender_handle sndr, identifier id)
 
     SENDER_ID(sndr) = htonll(id);
     sndr->pkt_next += sizeof(identifier);
+    val_at = sndr->pkt_next + sndr->origin_size;
 
-    for (;;) {
-	memcpy(sndr->pkt_next, record_get_value_ref(rec), sndr->val_size);
-	when = record_get_timestamp(rec);
-
-	if (rev == record_get_revision(rec))
-	    break;
+    if (sndr->has_lengths) {
+	*(uint32_t *)val_at = htonl((uint32_t)val_len);
+	memcpy(val_at + sizeof(uint32_t), sndr->val_buf, val_len);
+    } else if (FAILED(st = copy_value(sndr, rec, &rev, val_at,
+				      &val_len, &when, porigin)))
+	return st;
 
-	if (FAILED(st = record_read_lock(rec, &rev)))
-	    return st;
-    }
+    if (sndr->origin_size > 0)
+	*(microsec *)sndr->pkt_next = htonll(origin);
 
-    sndr->pkt_next += sndr->val_size;
+    sndr->pkt_next += rec_sz - sizeof(identifier);
 
-    sndr->record_revs[idx] = rev;
-    sndr->record_seqs[idx] = sndr->next_seq;
+    state->rev = rev;
+    state->seq = sndr->next_seq;
 
-    if (FAILED(st = clock_time(&sndr->mcast_insert_time)) ||
+staged:
+    if (FAILED(st = clock_time_fast(&sndr->mcast_insert_time)) ||
 	FAILED(st = latency_on_sample(sndr->stg_latency,
-				      sndr->mcast_insert_time - when)))
+				      sndr->mcast_insert_time -
+				      (sndr->is_nanosec ? when / 1000 : when))))
 	return st;
 
+    if (sndr->mcast_begin_time == 0)
+	sndr->mcast_begin_time = sndr->mcast_insert_time;
+
 #if defined(DEBUG_PROTOCOL)
     fprintf(sndr->debug_file,
 	    "%s       staging  seq %07ld, id #%07ld, rev %07ld, ",
 	    debug_time(), sndr->next_seq, id, rev);
 
-    fdump(record_get_value_ref(rec), NULL, 16, sndr->debug_file);
+    fdump(storage_get_value_ref(sndr->store, rec), NULL, 16,
+	  sndr->debug_file);
 #endif
     return sent_pkt;
 }
@@ -246,10 +401,15 @@ static status mcast_on_empty_queue(sender_handle sndr)
     status st;
     microsec now;
 
-    if (!FAILED(st = clock_time(&now))) {
+    if (!FAILED(st = clock_time_fast(&now))) {
 	if (sndr->mcast_insert_time != 0 &&
 	    (now - sndr->mcast_insert_time) >= sndr->max_pkt_age_usec) {
-	    st = mcast_send_pkt(sndr);
+	    /* NB. keep the updates of a commit in progress together, but not
+	       for longer than a heartbeat, lest a writer which died during
+	       the commit silence the sender for good */
+	    if (storage_get_epoch(sndr->store) >= 0 ||
+		(now - sndr->mcast_begin_time) >= sndr->heartbeat_usec)
+		st = mcast_send_pkt(sndr);
 	} else {
 	    if ((now - sndr->mcast_send_time) >= sndr->heartbeat_usec) {
 		if (sndr->pkt_next == sndr->pkt_buf) {
@@ -288,6 +448,8 @@ static status mcast_on_write(sender_handle sndr)
 	st = mcast_on_empty_queue(sndr);
     } else {
 	size_t q_cap = storage_get_queue_capacity(sndr->store);
+	q_index pf, ahead = (q_index)sndr->prefetch_ahead;
+
 	if ((size_t)qi > q_cap) {
 #if defined(DEBUG_PROTOCOL)
 	    fprintf(sndr->debug_file, "%s mcast queue overrun\n", debug_time());
@@ -299,8 +461,16 @@ static status mcast_on_write(sender_handle sndr)
 				 "mcast_on_write: change queue overrun");
 	}
 
+	/* NB. prefetch records ahead, so their cache misses overlap */
+	for (pf = sndr->last_q_idx;
+	     pf != new_q_idx && pf < sndr->last_q_idx + ahead; ++pf)
+	    storage_prefetch_queue(sndr->store, pf);
+
 	for (qi = sndr->last_q_idx; qi != new_q_idx; ++qi) {
 	    identifier id;
+	    if (ahead && qi + ahead < new_q_idx)
+		storage_prefetch_queue(sndr->store, qi + ahead);
+
 	    if (FAILED(st = storage_read_queue(sndr->store, qi, &id)) ||
 		FAILED(st = mcast_accum_record(sndr, id)) || st)
 		break;
@@ -357,14 +527,11 @@ static status tcp_write_buf(struct tcp_client *clnt)
 
     if (sent_sz > 0) {
 	status st2;
-	if (FAILED(st2 = clock_time(&clnt->tcp_send_time)) ||
-	    FAILED(st2 = spin_write_lock(&clnt->sndr->stats_lock, NULL)))
+	if (FAILED(st2 = clock_time_coarse(&clnt->tcp_send_time)))
 	    return st2;
 
 	clnt->sndr->last_active_time = clnt->tcp_send_time;
-	clnt->sndr->next_stats->tcp_bytes_sent += sent_sz;
-
-	spin_unlock(&clnt->sndr->stats_lock, 0);
+	clnt->sndr->total_stats->tcp_bytes_sent += sent_sz;
     }
 #if defined(DEBUG_PROTOCOL)
     fprintf(clnt->sndr->debug_file, "%s   %s tcp sent %lu bytes\n",
@@ -432,7 +599,9 @@ static status tcp_on_accept(sender_handle sndr, sock_handle sock)
     clnt->sock = accepted;
     clnt->in_next = clnt->in_buf;
     clnt->in_todo = sizeof(struct sequence_range);
-    clnt->pkt_size = sizeof(sequence) + sizeof(identifier) + sndr->val_size;
+    clnt->pkt_size = sizeof(sequence) + sizeof(identifier) +
+	sndr->origin_size + sndr->val_size +
+	(sndr->has_lengths ? sizeof(uint32_t) : 0);
 
     INVALIDATE_RANGE(clnt->union_range);
 
@@ -451,14 +620,14 @@ static status tcp_on_accept(sender_handle sndr, sock_handle sock)
 
     if (FAILED(st = sock_set_nonblock(accepted)) ||
 	FAILED(st = poller_add(sndr->poller, accepted, POLLIN | POLLOUT)) ||
-	FAILED(st = clock_time(&clnt->tcp_send_time)))
+	FAILED(st = clock_time_coarse(&clnt->tcp_send_time)))
 	return st;
 
     sndr->last_active_time = clnt->tcp_send_time;
 
     if (++sndr->client_count == 1) {
 	if (FAILED(st = poller_add(sndr->poller, sndr->mcast_sock, POLLOUT)) ||
-	    FAILED(st = clock_time(&sndr->mcast_send_time)))
+	    FAILED(st = clock_time_coarse(&sndr->mcast_send_time)))
 	    return st;
 
 	sndr->last_q_idx = storage_get_queue_head(sndr->store);
@@ -540,23 +709,33 @@ static status tcp_write_reply(sender_handle sndr, struct tcp_client *clnt,
 {
     record_handle rec = NULL;
     revision rev;
-    void *val_from;
-    void *val_to = CLIENT_VAL(clnt);
+    size_t val_len;
+    microsec origin = 0;
+    char *val_to = CLIENT_VAL(clnt);
 
     status st;
-    if (FAILED(st = storage_get_record(sndr->store, clnt->reply_id, &rec)))
+    if (FAILED(st = storage_get_record(sndr->store, clnt->reply_id, &rec)) ||
+	FAILED(st = storage_read_value(sndr->store, rec, NULL, 0, &rev, NULL)))
 	return st;
 
-    val_from = record_get_value_ref(rec);
-    do {
-	if (FAILED(st = record_read_lock(rec, &rev)))
-	    return st;
+    if (rev == 0)
+	return FALSE;
 
-	if (rev == 0)
-	    return FALSE;
+    if (sndr->has_lengths)
+	val_to += sizeof(uint32_t);
 
-	memcpy(val_to, val_from, sndr->val_size);
-    } while (rev != record_get_revision(rec));
+    if (FAILED(st = copy_value(sndr, rec, &rev, val_to, &val_len, NULL,
+			       sndr->origin_size > 0 ? &origin : NULL)))
+	return st;
+
+    if (sndr->origin_size > 0)
+	CLIENT_ORIGIN(clnt) = htonll(origin);
+
+    if (sndr->has_lengths) {
+	/* NB. gap replies are of fixed size, padded after the value */
+	*(uint32_t *)CLIENT_VAL(clnt) = htonl((uint32_t)val_len);
+	memset(val_to + val_len, 0, sndr->val_size - val_len);
+    }
 
     CLIENT_SEQ(clnt) = htonll(seq);
     CLIENT_ID(clnt) = htonll(clnt->reply_id);
@@ -576,17 +755,28 @@ static status tcp_write_reply(sender_handle sndr, struct tcp_client *clnt,
 
 static status tcp_write_in_range(sender_handle sndr, struct tcp_client *clnt)
 {
-    for (; clnt->reply_id < sndr->max_id; ++clnt->reply_id) {
-	sequence seq = sndr->record_seqs[clnt->reply_id - sndr->base_id];
-	if (seq < clnt->min_seq_found)
-	    clnt->min_seq_found = seq;
-
-	if (IS_WITHIN_RANGE(clnt->reply_range, seq)) {
-	    status st = tcp_write_reply(sndr, clnt, seq);
-	    if (FAILED(st))
-		return st;
-	    else if (!st)
-		break;
+    while (clnt->reply_id < sndr->max_id) {
+	identifier high;
+	status st;
+
+	/* NB. skip any records in a hole of a sparse storage */
+	if (FAILED(st = storage_find_allocated(sndr->store, clnt->reply_id,
+					       &clnt->reply_id, &high)))
+	    return st;
+
+	for (; clnt->reply_id < high; ++clnt->reply_id) {
+	    sequence seq = ((const struct record_state *)
+			    pagedir_lookup(sndr->record_states,
+					   clnt->reply_id - sndr->base_id))->seq;
+	    if (seq < clnt->min_seq_found)
+		clnt->min_seq_found = seq;
+
+	    if (IS_WITHIN_RANGE(clnt->reply_range, seq)) {
+		if (FAILED(st = tcp_write_reply(sndr, clnt, seq)))
+		    return st;
+		else if (st)
+		    return OK;
+	    }
 	}
     }
 
@@ -623,7 +813,7 @@ static status tcp_on_write(sender_handle sndr, sock_handle sock)
     if (IS_VALID_RANGE(clnt->reply_range))
 	return tcp_write_in_range(sndr, clnt);
 
-    if (FAILED(st = clock_time(&now)))
+    if (FAILED(st = clock_time_coarse(&now)))
 	return st;
 
     if ((now - clnt->tcp_send_time) >= sndr->heartbeat_usec) {
@@ -709,11 +899,7 @@ static status tcp_on_read(sender_handle sndr, sock_handle sock)
     clnt->in_next = clnt->in_buf;
     clnt->in_todo = sizeof(struct sequence_range);
 
-    if (FAILED(st = spin_write_lock(&sndr->stats_lock, NULL)))
-	return st;
-
-    ++sndr->next_stats->tcp_gap_count;
-    spin_unlock(&sndr->stats_lock, 0);
+    ++sndr->total_stats->tcp_gap_count;
     return st;
 }
 
@@ -751,8 +937,7 @@ static status init(sender_handle *psndr, const char *mmap_file,
 		   microsec orphan_timeout_usec, microsec max_pkt_age_usec)
 {
     status st;
-    identifier rec_dim;
-    size_t rec_rev_sz;
+    struct record_state blank_state;
 #if defined(DEBUG_PROTOCOL) || defined(DEBUG_GAPS)
     char debug_name[256];
 #endif
@@ -760,20 +945,24 @@ static status init(sender_handle *psndr, const char *mmap_file,
     BZERO(*psndr);
 
     if (FAILED(st = storage_open(&(*psndr)->store, mmap_file, O_RDONLY)) ||
-	FAILED(st = latency_create(&(*psndr)->stg_latency)))
+	FAILED(st = latency_create(&(*psndr)->stg_latency)) ||
+	FAILED(st = latency_create(&(*psndr)->pkt_latency)))
 	return st;
 
     (*psndr)->curr_stats = XMALLOC(struct sender_stats);
     if (!(*psndr)->curr_stats)
 	return NO_MEMORY;
 
-    (*psndr)->next_stats = XMALLOC(struct sender_stats);
-    if (!(*psndr)->next_stats)
+    (*psndr)->last_stats = XMALLOC(struct sender_stats);
+    if (!(*psndr)->last_stats)
+	return NO_MEMORY;
+
+    (*psndr)->total_stats = xcalloc(1, sizeof(struct sender_stats));
+    if (!(*psndr)->total_stats)
 	return NO_MEMORY;
 
     BZERO((*psndr)->curr_stats);
-    BZERO((*psndr)->next_stats);
-    spin_create(&(*psndr)->stats_lock);
+    BZERO((*psndr)->last_stats);
 
     (*psndr)->base_id = storage_get_base_id((*psndr)->store);
     (*psndr)->max_id = storage_get_max_id((*psndr)->store);
@@ -782,6 +971,7 @@ static status init(sender_handle *psndr, const char *mmap_file,
     (*psndr)->min_seq = 0;
     (*psndr)->ignore_recreate = ignore_recreate;
     (*psndr)->ignore_overrun = ignore_overrun;
+    (*psndr)->prefetch_ahead = DEFAULT_PREFETCH_AHEAD;
     (*psndr)->max_pkt_age_usec = max_pkt_age_usec;
     (*psndr)->heartbeat_usec = heartbeat_usec;
     (*psndr)->orphan_timeout_usec = orphan_timeout_usec;
@@ -791,18 +981,14 @@ static status init(sender_handle *psndr, const char *mmap_file,
 					     &(*psndr)->store_created_time)))
 	return st;
 
-    rec_dim = (*psndr)->max_id - (*psndr)->base_id;
-    rec_rev_sz = rec_dim * sizeof(revision);
-
-    (*psndr)->record_revs = xmalloc(rec_rev_sz);
-    if (!(*psndr)->record_revs)
-	return NO_MEMORY;
+    blank_state.rev = -1;
+    blank_state.seq = 0;
 
-    memset((*psndr)->record_revs, -1, rec_rev_sz);
-
-    (*psndr)->record_seqs = xcalloc(rec_dim, sizeof(sequence));
-    if (!(*psndr)->record_seqs)
-	return NO_MEMORY;
+    if (FAILED(st = pagedir_create(&(*psndr)->record_states,
+				   sizeof(struct record_state),
+				   (*psndr)->max_id - (*psndr)->base_id,
+				   &blank_state)))
+	return st;
 
     if (FAILED(st = sock_create(&(*psndr)->listen_sock, SOCK_STREAM, 0)) ||
 	FAILED(st = sock_set_reuseaddr((*psndr)->listen_sock, TRUE)) ||
@@ -840,12 +1026,37 @@ static status init(sender_handle *psndr, const char *mmap_file,
     }
 
     (*psndr)->mcast_mtu -= IP_OVERHEAD + UDP_OVERHEAD;
-    if ((*psndr)->mcast_mtu < (sizeof(sequence) +
-			       sizeof(microsec) +
-			       sizeof(identifier) + (*psndr)->val_size))
+    if ((*psndr)->mcast_mtu <= FRAGMENT_OVERHEAD)
 	return error_msg(MTU_TOO_SMALL,
 			 "sender_create: MTU too small for storage record");
 
+    /* NB. the records of a traced storage are sent with their origins */
+    (*psndr)->origin_size =
+	((storage_get_flags((*psndr)->store) & STORAGE_TRACED)
+	 ? sizeof(microsec) : 0);
+
+    /* NB. values are sent with their lengths if they may vary or if they
+       may not fit within one packet */
+    (*psndr)->has_lengths =
+	(storage_get_flags((*psndr)->store) & STORAGE_VARLEN) ||
+	(*psndr)->mcast_mtu < (sizeof(sequence) + sizeof(microsec) +
+			       sizeof(identifier) + (*psndr)->origin_size +
+			       (*psndr)->val_size);
+
+    (*psndr)->frag_size =
+	(*psndr)->mcast_mtu - FRAGMENT_OVERHEAD - (*psndr)->origin_size;
+    (*psndr)->is_lock_free =
+	((storage_get_flags((*psndr)->store) &
+	  (STORAGE_ATOMIC | STORAGE_DOUBLE)) != 0);
+    (*psndr)->is_nanosec =
+	((storage_get_flags((*psndr)->store) & STORAGE_NANOSEC) != 0);
+
+    if ((*psndr)->has_lengths) {
+	(*psndr)->val_buf = xmalloc((*psndr)->val_size);
+	if (!(*psndr)->val_buf)
+	    return NO_MEMORY;
+    }
+
     (*psndr)->pkt_buf = xmalloc((*psndr)->mcast_mtu);
     if (!(*psndr)->pkt_buf)
 	return NO_MEMORY;
@@ -854,14 +1065,16 @@ static status init(sender_handle *psndr, const char *mmap_file,
 
     st = sprintf((*psndr)->hello_str,
 		 "%d\r\n%d\r\n%s\r\n%d\r\n%lu\r\n%" PRId64 "\r\n"
-		 "%" PRId64 "\r\n%lu\r\n%lu\r\n%" PRId64 "\r\n%" PRId64 "\r\n",
+		 "%" PRId64 "\r\n%lu\r\n%lu\r\n%" PRId64 "\r\n%" PRId64 "\r\n"
+		 "%u\r\n",
 		 (version_get_wire_major() << 8) | version_get_wire_minor(),
 		 (int)storage_get_data_version((*psndr)->store),
 		 mcast_address, mcast_port, (unsigned long)(*psndr)->mcast_mtu,
 		 (*psndr)->base_id, (*psndr)->max_id,
 		 (unsigned long)storage_get_value_size((*psndr)->store),
 		 (unsigned long)storage_get_queue_capacity((*psndr)->store),
-		 max_pkt_age_usec, (*psndr)->heartbeat_usec);
+		 max_pkt_age_usec, (*psndr)->heartbeat_usec,
+		 storage_get_flags((*psndr)->store));
 
     if (st < 0)
 	return error_errno("sender_create: sprintf");
@@ -876,7 +1089,7 @@ static status init(sender_handle *psndr, const char *mmap_file,
 	FAILED(st = poller_create(&(*psndr)->poller, 10)) ||
 	FAILED(st = poller_add((*psndr)->poller,
 			       (*psndr)->listen_sock, POLLIN)) ||
-	FAILED(st = clock_time(&(*psndr)->last_active_time)))
+	FAILED(st = clock_time_coarse(&(*psndr)->last_active_time)))
 	return st;
 
 #if defined(DEBUG_PROTOCOL) || defined(DEBUG_GAPS)
@@ -932,16 +1145,18 @@ status sender_destroy(sender_handle *psndr)
                                     *psndr))) ||
 	FAILED(st = poller_destroy(&(*psndr)->poller)) ||
 	FAILED(st = storage_destroy(&(*psndr)->store)) ||
+	FAILED(st = pagedir_destroy(&(*psndr)->record_states)) ||
 	FAILED(st = sock_addr_destroy(&(*psndr)->sendto_addr)) ||
 	FAILED(st = sock_addr_destroy(&(*psndr)->listen_addr)) ||
-	FAILED(st = latency_destroy(&(*psndr)->stg_latency)))
+	FAILED(st = latency_destroy(&(*psndr)->stg_latency)) ||
+	FAILED(st = latency_destroy(&(*psndr)->pkt_latency)))
 	return st;
 
-    xfree((*psndr)->next_stats);
+    xfree((void *)(*psndr)->total_stats);
+    xfree((*psndr)->last_stats);
     xfree((*psndr)->curr_stats);
-    xfree((*psndr)->record_seqs);
-    xfree((*psndr)->record_revs);
     xfree((*psndr)->pkt_buf);
+    xfree((*psndr)->val_buf);
 
 #if defined(DEBUG_PROTOCOL) || defined(DEBUG_GAPS)
     if ((*psndr)->debug_file && fclose((*psndr)->debug_file) == EOF)
@@ -957,6 +1172,11 @@ storage_handle sender_get_storage(sender_handle sndr)
     return sndr->store;
 }
 
+void sender_set_prefetch(sender_handle sndr, size_t ahead)
+{
+    sndr->prefetch_ahead = ahead;
+}
+
 unsigned short sender_get_listen_port(sender_handle sndr)
 {
     return sock_addr_get_port(sndr->listen_addr);
@@ -977,9 +1197,11 @@ status sender_run(sender_handle sndr)
              FAILED(st = poller_process_events(sndr->poller, event_func,
                                                sndr))) ||
 	    FAILED(st = storage_get_touched_time(sndr->store, &when)) ||
-	    FAILED(st = clock_time(&now)))
+	    FAILED(st = clock_time_coarse(&now)))
 	    break;
 
+	/* NB. these checks are against timeouts of a second or more */
+
 	if (sndr->orphan_timeout_usec > 0 &&
 	    (now - when) >= sndr->orphan_timeout_usec) {
 	    st = error_msg(STORAGE_ORPHANED, "sender_run: storage is orphaned");
@@ -1074,19 +1296,86 @@ double sender_get_storage_stddev_latency(sender_handle sndr)
     return latency_get_stddev(sndr->stg_latency);
 }
 
+double sender_get_storage_percentile_latency(sender_handle sndr, double pct)
+{
+    return latency_get_percentile(sndr->stg_latency, pct);
+}
+
+long sender_get_packet_count(sender_handle sndr)
+{
+    return latency_get_count(sndr->pkt_latency);
+}
+
+double sender_get_packet_min_latency(sender_handle sndr)
+{
+    return latency_get_min(sndr->pkt_latency);
+}
+
+double sender_get_packet_mean_latency(sender_handle sndr)
+{
+    return latency_get_mean(sndr->pkt_latency);
+}
+
+double sender_get_packet_max_latency(sender_handle sndr)
+{
+    return latency_get_max(sndr->pkt_latency);
+}
+
+double sender_get_packet_stddev_latency(sender_handle sndr)
+{
+    return latency_get_stddev(sndr->pkt_latency);
+}
+
+double sender_get_packet_percentile_latency(sender_handle sndr, double pct)
+{
+    return latency_get_percentile(sndr->pkt_latency, pct);
+}
+
+long sender_get_total_tcp_gap_count(sender_handle sndr)
+{
+    return sndr->total_stats->tcp_gap_count;
+}
+
+long sender_get_total_tcp_bytes_sent(sender_handle sndr)
+{
+    return sndr->total_stats->tcp_bytes_sent;
+}
+
+long sender_get_total_mcast_bytes_sent(sender_handle sndr)
+{
+    return sndr->total_stats->mcast_bytes_sent;
+}
+
+long sender_get_total_mcast_packets_sent(sender_handle sndr)
+{
+    return sndr->total_stats->mcast_packets_sent;
+}
+
+long sender_get_total_storage_record_count(sender_handle sndr)
+{
+    return latency_get_total_count(sndr->stg_latency);
+}
+
 status sender_roll_stats(sender_handle sndr)
 {
     status st;
-    struct sender_stats *tmp;
-    if (FAILED(st = spin_write_lock(&sndr->stats_lock, NULL)))
-	return st;
+    struct sender_stats total;
+
+    /* NB. the totals are only written by the thread running the sender,
+       and are never reset, so that it need not take a lock to count */
+    total = *sndr->total_stats;
 
-    tmp = sndr->next_stats;
-    sndr->next_stats = sndr->curr_stats;
-    sndr->curr_stats = tmp;
+    sndr->curr_stats->tcp_gap_count =
+	total.tcp_gap_count - sndr->last_stats->tcp_gap_count;
+    sndr->curr_stats->tcp_bytes_sent =
+	total.tcp_bytes_sent - sndr->last_stats->tcp_bytes_sent;
+    sndr->curr_stats->mcast_bytes_sent =
+	total.mcast_bytes_sent - sndr->last_stats->mcast_bytes_sent;
+    sndr->curr_stats->mcast_packets_sent =
+	total.mcast_packets_sent - sndr->last_stats->mcast_packets_sent;
 
-    BZERO(sndr->next_stats);
-    spin_unlock(&sndr->stats_lock, 0);
+    *sndr->last_stats = total;
 
-    return latency_roll(sndr->stg_latency);
+    st = latency_roll(sndr->stg_latency);
+    return FAILED(st) ? st : latency_roll(sndr->pkt_latency);
 }
@@ -0,0 +1,387 @@
+/*
+  Copyright (c)2018-2024 Justin Flude.
+  Use of this source code is governed by the COPYING file.
+*/
+
+#include <lancaster/error.h>
+#include <lancaster/statseg.h>
+#include <lancaster/sync.h>
+#include <lancaster/xalloc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAX_SPINS 10000
+#define MAX_WAIT_USEC (1 * 1000000)
+#define SLEEP_USEC 1000
+
+#define SEG_REV(seg) (*(volatile int64_t *)&(seg)->data->rev)
+
+struct statseg {
+    struct statseg_data *data;
+    char *mmap_file;
+    int seg_fd;
+    boolean is_owner;
+};
+
+/* NB. returns FALSE if the segment already exists and O_EXCL was given */
+static status open_segment(statseg_handle seg, const char *mmap_file,
+			   int open_flags)
+{
+    if (strncmp(mmap_file, "shm:", 4) == 0) {
+	seg->seg_fd = shm_open(mmap_file + 4, open_flags, 0644);
+	if (seg->seg_fd != -1)
+	    return TRUE;
+	else if (errno != EEXIST || !(open_flags & O_EXCL))
+	    return error_eintr("open_segment: shm_open");
+    } else {
+	seg->seg_fd = open(mmap_file, open_flags, 0644);
+	if (seg->seg_fd != -1)
+	    return TRUE;
+	else if (errno != EEXIST || !(open_flags & O_EXCL))
+	    return error_eintr("open_segment: open");
+    }
+
+    return FALSE;
+}
+
+static status map_segment(statseg_handle seg, const char *mmap_file,
+			  int open_flags)
+{
+    int prot = PROT_READ;
+
+    if ((open_flags & O_ACCMODE) != O_RDONLY)
+	prot |= PROT_WRITE;
+
+    if (open_flags & O_CREAT) {
+	if (ftruncate(seg->seg_fd, sizeof(struct statseg_data)) == -1)
+	    return (errno == EINTR ? error_eintr : error_errno)
+		("map_segment: ftruncate");
+    } else {
+	struct stat file_stat;
+	if (fstat(seg->seg_fd, &file_stat) == -1)
+	    return error_errno("map_segment: fstat");
+
+	if ((size_t)file_stat.st_size < sizeof(struct statseg_data))
+	    return error_msg(STORAGE_CORRUPTED,
+			     "map_segment: segment is truncated");
+    }
+
+    seg->data = mmap(NULL, sizeof(struct statseg_data), prot,
+		     MAP_SHARED, seg->seg_fd, 0);
+
+    if (seg->data == MAP_FAILED) {
+	seg->data = NULL;
+	return error_errno("map_segment: mmap");
+    }
+
+    seg->mmap_file = xstrdup(mmap_file);
+    return seg->mmap_file ? OK : NO_MEMORY;
+}
+
+/* NB. a publisher holds an exclusive lock on its segment until it exits,
+   so that no other can reinitialize the segment while it is in use */
+static status lock_segment(statseg_handle seg)
+{
+    if (flock(seg->seg_fd, LOCK_EX | LOCK_NB) == -1) {
+	if (errno != EWOULDBLOCK)
+	    return error_eintr("statseg_create: flock");
+
+	errno = EEXIST;
+	return error_errno("statseg_create");
+    }
+
+    return OK;
+}
+
+/* NB. an existing segment is only reused if it was left behind by a
+   publisher which is no longer running (even one which died before it
+   finished initializing the segment), and is never truncated */
+static status reuse_segment(statseg_handle seg, const char *mmap_file)
+{
+    status st;
+    struct stat file_stat;
+
+    if (FAILED(st = open_segment(seg, mmap_file, O_RDWR)) ||
+	FAILED(st = lock_segment(seg)))
+	return st;
+
+    if (fstat(seg->seg_fd, &file_stat) == -1)
+	return error_errno("statseg_create: fstat");
+
+    /* NB. a segment whose publisher died before sizing it is sized now */
+    if (FAILED(st = map_segment(seg, mmap_file,
+				((size_t)file_stat.st_size <
+				 sizeof(struct statseg_data)
+				 ? O_RDWR | O_CREAT : O_RDWR))))
+	return st;
+
+    if (seg->data->pid > 0 &&
+	(kill((pid_t)seg->data->pid, 0) == 0 || errno != ESRCH)) {
+	errno = EEXIST;
+	return error_errno("statseg_create");
+    }
+
+    return OK;
+}
+
+status statseg_create(statseg_handle *pseg, const char *mmap_file,
+		      const char *program, const char *storage_file)
+{
+    status st;
+    if (!pseg || !mmap_file || !program || !storage_file)
+	return error_invalid_arg("statseg_create");
+
+    *pseg = XMALLOC(struct statseg);
+    if (!*pseg)
+	return NO_MEMORY;
+
+    BZERO(*pseg);
+    (*pseg)->seg_fd = -1;
+
+    if (FAILED(st = open_segment(*pseg, mmap_file,
+				 O_RDWR | O_CREAT | O_EXCL)))
+	goto fail;
+
+    if (st) {
+	if (!FAILED(st = lock_segment(*pseg)))
+	    st = map_segment(*pseg, mmap_file, O_RDWR | O_CREAT);
+    } else
+	st = reuse_segment(*pseg, mmap_file);
+
+    if (FAILED(st))
+	goto fail;
+
+    (*pseg)->is_owner = TRUE;
+
+    memset((*pseg)->data, 0, sizeof(struct statseg_data));
+    (*pseg)->data->version = STATSEG_VERSION;
+    (*pseg)->data->pid = getpid();
+
+    strncpy((*pseg)->data->program, program,
+	    sizeof((*pseg)->data->program) - 1);
+    strncpy((*pseg)->data->storage, storage_file,
+	    sizeof((*pseg)->data->storage) - 1);
+
+    SYNC_SYNCHRONIZE();
+    (*pseg)->data->magic = STATSEG_MAGIC_NUMBER;
+    return OK;
+
+fail:
+    error_save_last();
+    statseg_destroy(pseg);
+    error_restore_last();
+    return st;
+}
+
+status statseg_open(statseg_handle *pseg, const char *mmap_file)
+{
+    status st;
+    if (!pseg || !mmap_file)
+	return error_invalid_arg("statseg_open");
+
+    *pseg = XMALLOC(struct statseg);
+    if (!*pseg)
+	return NO_MEMORY;
+
+    BZERO(*pseg);
+    (*pseg)->seg_fd = -1;
+
+    if (FAILED(st = open_segment(*pseg, mmap_file, O_RDONLY)) ||
+	FAILED(st = map_segment(*pseg, mmap_file, O_RDONLY)))
+	goto fail;
+
+    if ((*pseg)->data->magic != STATSEG_MAGIC_NUMBER) {
+	st = error_msg(STORAGE_CORRUPTED, "statseg_open: segment is corrupt");
+	goto fail;
+    }
+
+    if ((*pseg)->data->version != STATSEG_VERSION) {
+	st = error_msg(WRONG_FILE_VERSION,
+		       "statseg_open: incompatible segment version");
+	goto fail;
+    }
+
+    return OK;
+
+fail:
+    error_save_last();
+    statseg_destroy(pseg);
+    error_restore_last();
+    return st;
+}
+
+status statseg_destroy(statseg_handle *pseg)
+{
+    if (!pseg || !*pseg)
+	return OK;
+
+    if ((*pseg)->data) {
+	if (munmap((*pseg)->data, sizeof(struct statseg_data)) == -1)
+	    return error_errno("statseg_destroy: munmap");
+
+	(*pseg)->data = NULL;
+    }
+
+    /* NB. a segment is only of use while its owner is alive, and is removed
+       before its lock is released, lest it be reused just to be removed */
+    if ((*pseg)->is_owner && (*pseg)->mmap_file) {
+	if (strncmp((*pseg)->mmap_file, "shm:", 4) == 0) {
+	    if (shm_unlink((*pseg)->mmap_file + 4) == -1 && errno != ENOENT)
+		return error_errno("statseg_destroy: shm_unlink");
+	} else if (unlink((*pseg)->mmap_file) == -1 && errno != ENOENT)
+	    return error_errno("statseg_destroy: unlink");
+    }
+
+    if ((*pseg)->seg_fd != -1) {
+	if (close((*pseg)->seg_fd) == -1)
+	    return error_eintr("statseg_destroy: close");
+
+	(*pseg)->seg_fd = -1;
+    }
+
+    xfree((*pseg)->mmap_file);
+    XFREE(*pseg);
+    return OK;
+}
+
+const char *statseg_get_file(statseg_handle seg)
+{
+    return seg->mmap_file;
+}
+
+status statseg_begin(statseg_handle seg)
+{
+    if (!seg->is_owner)
+	return error_msg(STORAGE_READ_ONLY,
+			 "statseg_begin: segment is read-only");
+
+    if (SEG_REV(seg) & 1)
+	return error_msg(DEADLOCK_DETECTED,
+			 "statseg_begin: segment is already being updated");
+
+    SEG_REV(seg) = SEG_REV(seg) + 1;
+    SYNC_SYNCHRONIZE();
+    return OK;
+}
+
+static struct statseg_counter *get_counter(statseg_handle seg, size_t idx,
+					   const char *name)
+{
+    struct statseg_counter *c = &seg->data->counters[idx];
+    strncpy(c->name, name, sizeof(c->name) - 1);
+
+    if ((int64_t)idx >= seg->data->counter_count)
+	seg->data->counter_count = idx + 1;
+
+    return c;
+}
+
+status statseg_set_counter(statseg_handle seg, size_t idx,
+			   const char *name, long value)
+{
+    if (idx >= STATSEG_MAX_COUNTERS || !name)
+	return error_invalid_arg("statseg_set_counter");
+
+    get_counter(seg, idx, name)->value = value;
+    return OK;
+}
+
+status statseg_set_total(statseg_handle seg, size_t idx,
+			 const char *name, long total)
+{
+    if (idx >= STATSEG_MAX_COUNTERS || !name)
+	return error_invalid_arg("statseg_set_total");
+
+    get_counter(seg, idx, name)->total = total;
+    return OK;
+}
+
+status statseg_set_gauge(statseg_handle seg, size_t idx,
+			 const char *name, long value)
+{
+    struct statseg_counter *c;
+    if (idx >= STATSEG_MAX_COUNTERS || !name)
+	return error_invalid_arg("statseg_set_gauge");
+
+    c = get_counter(seg, idx, name);
+    c->value = c->total = value;
+    return OK;
+}
+
+status statseg_set_latency(statseg_handle seg, size_t idx,
+			   const struct statseg_latency *lat)
+{
+    struct statseg_latency *l;
+    if (idx >= STATSEG_MAX_LATENCIES || !lat)
+	return error_invalid_arg("statseg_set_latency");
+
+    l = &seg->data->latencies[idx];
+    *l = *lat;
+    l->name[sizeof(l->name) - 1] = '\0';
+
+    if ((int64_t)idx >= seg->data->latency_count)
+	seg->data->latency_count = idx + 1;
+
+    return OK;
+}
+
+status statseg_set_interval(statseg_handle seg, microsec interval)
+{
+    if (interval < 0)
+	return error_invalid_arg("statseg_set_interval");
+
+    seg->data->interval_usec = interval;
+    return OK;
+}
+
+status statseg_end(statseg_handle seg, microsec now)
+{
+    if (!(SEG_REV(seg) & 1))
+	return error_msg(DEADLOCK_DETECTED,
+			 "statseg_end: segment is not being updated");
+
+    seg->data->update_time = now;
+
+    SYNC_SYNCHRONIZE();
+    SEG_REV(seg) = SEG_REV(seg) + 1;
+    return OK;
+}
+
+status statseg_read(statseg_handle seg, struct statseg_data *copy)
+{
+    int spins = 0, sleeps = 0;
+    if (!copy)
+	return error_invalid_arg("statseg_read");
+
+    for (;;) {
+	int64_t rev = SEG_REV(seg);
+	if (!(rev & 1)) {
+	    SYNC_SYNCHRONIZE();
+	    memcpy(copy, seg->data, sizeof(struct statseg_data));
+	    SYNC_SYNCHRONIZE();
+
+	    if (SEG_REV(seg) == rev) {
+		copy->rev = rev;
+		return OK;
+	    }
+	}
+
+	if (++spins <= MAX_SPINS) {
+	    CPU_RELAX();
+	} else {
+	    status st;
+	    if (++sleeps > (MAX_WAIT_USEC / SLEEP_USEC))
+		return error_msg(DEADLOCK_DETECTED,
+				 "statseg_read: deadlock detected");
+
+	    if (FAILED(st = clock_sleep(SLEEP_USEC)))
+		return st;
+	}
+    }
+}
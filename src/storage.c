@@ -4,11 +4,17 @@
   Use of this source code is governed by the COPYING file.
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for SEEK_DATA and SEEK_HOLE */
+#endif
+
 #include <lancaster/clock.h>
 #include <lancaster/error.h>
 #include <lancaster/spin.h>
 #include <lancaster/storage.h>
+#include <lancaster/storage_inline.h>
 #include <lancaster/sync.h>
+#include <lancaster/thread.h>
 #include <lancaster/version.h>
 #include <lancaster/xalloc.h>
 #include <errno.h>
@@ -16,14 +22,19 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/file.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
-#include "xalloca.h"
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
+#if defined(LANCASTER_X86_64_CPU) && defined(__GNUC__)
+#include <cpuid.h>
+#define HAVE_ATOMIC_CELLS
+#endif
+
 #ifndef O_ACCMODE
 #define O_ACCMODE (O_RDONLY | O_WRONLY | O_RDWR)
 #endif
@@ -36,12 +47,57 @@
 #define _SC_PAGESIZE _SC_PAGE_SIZE
 #endif
 
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+#define KNOWN_FLAGS \
+    (STORAGE_SPARSE | STORAGE_VARLEN | STORAGE_ATOMIC | STORAGE_DOUBLE | \
+     STORAGE_NANOSEC | STORAGE_TRACED)
+
+/* NB. a storage using none of the extensions to the original layout keeps
+   its file version, so that older programs may still open it */
+#define BASE_FILE_MAJOR 1
+#define BASE_FILE_MINOR 0
+
+/* NB. the value of a record in an atomic storage shares a 16-byte aligned
+   cell with a copy of its revision, so both may be loaded in one access */
+#define ATOMIC_CELL_SIZE 16
+#define ATOMIC_VALUE_SIZE (ATOMIC_CELL_SIZE - sizeof(revision))
+
+#define CELL_LOAD_LOCKED 0
+#define CELL_LOAD_SSE 1
+#define CELL_LOAD_CMPXCHG 2
+
 struct record {
     volatile revision rev;
     microsec ts;
     char val[1];
 };
 
+struct property_ref {
+    size_t offset;
+    size_t size;
+};
+
+struct arena_tag {
+    size_t total;
+    size_t owner;
+};
+
+struct log_entry {
+    identifier id;
+    revision rev;
+    microsec ts;
+    char val[1];
+};
+
+struct history_entry {
+    volatile revision rev;
+    microsec ts;
+    char val[1];
+};
+
 struct segment {
     unsigned magic;
     unsigned short file_version;
@@ -63,6 +119,21 @@ struct segment {
     size_t q_mask;
     q_index q_head;
     union {
+	struct {
+	    unsigned flags;
+	    size_t arena_size;
+	    size_t arena_offset;
+	    volatile size_t arena_top;
+	    volatile spin_lock arena_lock;
+	    size_t len_offset;
+	    size_t hist_depth;
+	    size_t hist_offset;
+	    size_t log_mask;
+	    size_t log_offset;
+	    volatile q_index log_head;
+	    volatile revision epoch;
+	    size_t origin_offset;
+	} ext;
 	char reserved[1024];
     } new_fields;
     identifier change_q[1];
@@ -77,42 +148,380 @@ struct storage {
     int seg_fd;
     boolean is_read_only;
     boolean is_persistent;
+    int cell_load;
 };
 
 #define MAGIC_NUMBER 0x0C0FFEE0
 
+/* NB. fails to compile if the inline accessors disagree on the layout */
+typedef char fast_record_layout_check[
+    (offsetof(struct record, ts) == offsetof(struct fast_record, ts) &&
+     offsetof(struct record, val) == offsetof(struct fast_record, val))
+    ? 1 : -1];
+
 #define STORAGE_RECORD(stg, base, idx)					\
     ((record_handle)((char *)base + (idx) * (stg)->seg->rec_size))
 
+#define STORAGE_FLAGS(stg) ((stg)->seg->new_fields.ext.flags)
+#define IS_SPARSE(stg) (STORAGE_FLAGS(stg) & STORAGE_SPARSE)
+
+#define IS_VARLEN(stg) (STORAGE_FLAGS(stg) & STORAGE_VARLEN)
+#define IS_ATOMIC(stg) (STORAGE_FLAGS(stg) & STORAGE_ATOMIC)
+
+/* NB. a double-buffered record has two slots, each a value followed by its
+   timestamp, of which the current one is chosen by its revision's parity */
+#define IS_DOUBLE(stg) (STORAGE_FLAGS(stg) & STORAGE_DOUBLE)
+#define IS_NANOSEC(stg) (STORAGE_FLAGS(stg) & STORAGE_NANOSEC)
+#define IS_TRACED(stg) (STORAGE_FLAGS(stg) & STORAGE_TRACED)
+#define SLOT_VALUE_SIZE(sz) ALIGNED_SIZE(sz, DEFAULT_ALIGNMENT)
+#define SLOT_SIZE(sz) (SLOT_VALUE_SIZE(sz) + sizeof(microsec))
+#define VALUE_SLOT(stg, rec, i)						\
+    ((rec)->val + (i) * SLOT_SIZE((stg)->seg->val_size))
+#define SLOT_TIME(stg, slot)						\
+    (*(microsec *)((slot) + SLOT_VALUE_SIZE((stg)->seg->val_size)))
+#define CURRENT_SLOT(stg, rec, rev)				\
+    VALUE_SLOT(stg, rec, ((rev) & ~SPIN_MASK) & 1)
+#define VALUE_LENGTH(stg, rec)						\
+    (*(size_t *)((char *)(rec) + (stg)->seg->new_fields.ext.len_offset))
+#define ORIGIN_TIME(stg, rec)						\
+    (*(microsec *)((char *)(rec) + (stg)->seg->new_fields.ext.origin_offset))
+
+#define STORAGE_ARENA(stg) ((stg)->seg->new_fields.ext)
+#define HAS_ARENA(stg) (STORAGE_ARENA(stg).arena_offset != 0)
+#define PROPERTY_REF(stg, rec)						\
+    ((struct property_ref *)((char *)(rec) + (stg)->seg->prop_offset))
+
+/* NB. each revision of a record is kept in the entry of its history ring
+   selected by the revision itself, so the ring needs no head index */
+#define HIST_DEPTH(stg) ((stg)->seg->new_fields.ext.hist_depth)
+#define HIST_ENTRY_SIZE(sz)						\
+    (offsetof(struct history_entry, val) + ALIGNED_SIZE(sz, DEFAULT_ALIGNMENT))
+#define HIST_ENTRY_AT(stg, rec, i)					\
+    ((struct history_entry *)						\
+     ((char *)(rec) + (stg)->seg->new_fields.ext.hist_offset +		\
+      (i) * HIST_ENTRY_SIZE((stg)->seg->val_size)))
+#define HIST_ENTRY(stg, rec, rev)					\
+    HIST_ENTRY_AT(stg, rec, (rev) & (HIST_DEPTH(stg) - 1))
+
+#define UPDATE_LOG(stg) ((stg)->seg->new_fields.ext)
+#define HAS_LOG(stg) (UPDATE_LOG(stg).log_offset != 0)
+#define LOG_ENTRY_SIZE(sz)						\
+    (offsetof(struct log_entry, val) + ALIGNED_SIZE(sz, DEFAULT_ALIGNMENT))
+#define LOG_ENTRY(stg, idx)						\
+    ((struct log_entry *)						\
+     ((char *)(stg)->seg + UPDATE_LOG(stg).log_offset +			\
+      ((idx) & UPDATE_LOG(stg).log_mask) *				\
+      LOG_ENTRY_SIZE((stg)->seg->val_size)))
+
+static int mmap_share_flags(unsigned flags)
+{
+    /* NB. a sparse storage reserves its address space but not its memory */
+    return MAP_SHARED | ((flags & STORAGE_SPARSE) ? MAP_NORESERVE : 0);
+}
+
+static int cell_load_method(storage_handle store)
+{
+#ifdef HAVE_ATOMIC_CELLS
+    unsigned a, b, c, d;
+    if (!IS_ATOMIC(store) || !__get_cpuid(1, &a, &b, &c, &d) ||
+	!(c & bit_CMPXCHG16B))
+	return CELL_LOAD_LOCKED;
+
+    /* NB. aligned 16-byte SSE loads are atomic on processors with AVX,
+       while CMPXCHG16B must be able to write to the cell it loads */
+    if (c & bit_AVX)
+	return CELL_LOAD_SSE;
+
+    if (!store->is_read_only)
+	return CELL_LOAD_CMPXCHG;
+#else
+    (void)store;
+#endif
+    return CELL_LOAD_LOCKED;
+}
+
+static void load_cell(storage_handle store, const volatile void *cell,
+		      int64_t *words)
+{
+#ifdef HAVE_ATOMIC_CELLS
+    if (store->cell_load == CELL_LOAD_SSE) {
+	__asm__ __volatile__("movdqa %1, %%xmm0\n\t"
+			     "movdqu %%xmm0, %0"
+			     : "=m"(*(int64_t (*)[2])words)
+			     : "m"(*(const volatile int64_t (*)[2])cell)
+			     : "xmm0", "memory");
+	return;
+    } else if (store->cell_load == CELL_LOAD_CMPXCHG) {
+	/* NB. a cell equal to zero is exchanged with zero, which is benign */
+	int64_t lo = 0, hi = 0;
+	__asm__ __volatile__("lock; cmpxchg16b %2"
+			     : "+a"(lo), "+d"(hi),
+			       "+m"(*(volatile int64_t (*)[2])cell)
+			     : "b"((int64_t)0), "c"((int64_t)0)
+			     : "cc", "memory");
+	words[0] = lo;
+	words[1] = hi;
+	return;
+    }
+#else
+    (void)store;
+#endif
+    memcpy(words, (const void *)cell, ATOMIC_CELL_SIZE);
+}
+
+static void store_cell(volatile void *cell, const int64_t *words)
+{
+#ifdef HAVE_ATOMIC_CELLS
+    int64_t lo = ((volatile int64_t *)cell)[0];
+    int64_t hi = ((volatile int64_t *)cell)[1];
+    unsigned char done;
+
+    do
+	__asm__ __volatile__("lock; cmpxchg16b %1\n\t"
+			     "sete %0"
+			     : "=q"(done), "+m"(*(volatile int64_t (*)[2])cell),
+			       "+a"(lo), "+d"(hi)
+			     : "b"(words[0]), "c"(words[1])
+			     : "cc", "memory");
+    while (!done);
+#else
+    memcpy((void *)cell, words, ATOMIC_CELL_SIZE);
+#endif
+}
+
+static void fill_slots(storage_handle store, record_handle rec,
+		       const void *val, size_t len, microsec ts)
+{
+    int i;
+    for (i = 0; i < 2; ++i) {
+	char *slot = VALUE_SLOT(store, rec, i);
+	memcpy(slot, val, len);
+	SLOT_TIME(store, slot) = ts;
+    }
+}
+
+/* NB. the current slot of a double-buffered record cannot change while
+   the record is write-locked */
+static const void *locked_value_ref(storage_handle store, record_handle rec)
+{
+    return IS_DOUBLE(store) ? CURRENT_SLOT(store, rec, rec->rev) : rec->val;
+}
+
+static void copy_history(storage_handle from_store, record_handle from_rec,
+			 storage_handle to_store, record_handle to_rec)
+{
+    size_t i, val_sz;
+    if (HIST_DEPTH(from_store) != HIST_DEPTH(to_store)) {
+	memset(HIST_ENTRY_AT(to_store, to_rec, 0), 0,
+	       HIST_DEPTH(to_store) *
+	       HIST_ENTRY_SIZE(to_store->seg->val_size));
+	return;
+    }
+
+    val_sz = (from_store->seg->val_size < to_store->seg->val_size
+	      ? from_store->seg->val_size : to_store->seg->val_size);
+
+    for (i = 0; i < HIST_DEPTH(to_store); ++i) {
+	struct history_entry *from_e = HIST_ENTRY_AT(from_store, from_rec, i);
+	struct history_entry *to_e = HIST_ENTRY_AT(to_store, to_rec, i);
+
+	to_e->rev = from_e->rev;
+	to_e->ts = from_e->ts;
+	memcpy(to_e->val, from_e->val, val_sz);
+    }
+}
+
+static record_handle find_allocated(storage_handle store, record_handle rec,
+				    record_handle *pend)
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    off_t data_off, hole_off;
+    size_t hdr_sz, rec_sz, idx;
+
+    if (!IS_SPARSE(store) || rec >= store->limit) {
+	*pend = store->limit;
+	return rec;
+    }
+
+    data_off = lseek(store->seg_fd, (char *)rec - (char *)store->seg,
+		     SEEK_DATA);
+
+    if (data_off == -1) {
+	/* NB. if the file system cannot say, every record is allocated */
+	*pend = store->limit;
+	return errno == ENXIO ? store->limit : rec;
+    }
+
+    hole_off = lseek(store->seg_fd, data_off, SEEK_HOLE);
+    if (hole_off == -1 || (size_t)hole_off > store->seg->seg_size)
+	hole_off = store->seg->seg_size;
+
+    hdr_sz = store->seg->hdr_size;
+    rec_sz = store->seg->rec_size;
+
+    idx = (hole_off - hdr_sz + rec_sz - 1) / rec_sz;
+    *pend = STORAGE_RECORD(store, store->first, idx);
+    if (*pend > store->limit)
+	*pend = store->limit;
+
+    /* NB. a record which begins within a hole has never been written, and
+       reading it would allocate the page before the data */
+    idx = (data_off - hdr_sz + rec_sz - 1) / rec_sz;
+    rec = STORAGE_RECORD(store, store->first, idx);
+    return rec < store->limit ? rec : store->limit;
+#else
+    *pend = store->limit;
+    return rec;
+#endif
+}
+
+/* NB. holes can only be sought forwards, so the last range of allocated
+   records below a given record is found by scanning the ranges up to it */
+static record_handle find_allocated_below(storage_handle store,
+					  record_handle rec,
+					  record_handle *pbegin)
+{
+    record_handle next = store->first, end = store->first;
+    *pbegin = store->first;
+
+    while (next < rec) {
+	record_handle begin = find_allocated(store, next, &next);
+	if (begin >= rec)
+	    break;
+
+	*pbegin = begin;
+	end = (next < rec ? next : rec);
+    }
+
+    return end;
+}
+
+/* NB. every handle holds a shared lock on the file of its storage, so that
+   storage_compact_arena can tell whether it has sole use of the storage */
+static status share_file(storage_handle store, const char *func)
+{
+    if (flock(store->seg_fd, LOCK_SH) == -1 &&
+	errno != EOPNOTSUPP && errno != ENOTSUP)
+	return error_eintr(func);
+
+    return OK;
+}
+
+static unsigned short file_version_for(const struct storage_options *opts)
+{
+    if (opts->flags == 0 && opts->arena_size == 0 &&
+	opts->history_depth == 0 && opts->log_capacity == 0)
+	return (BASE_FILE_MAJOR << 8) | BASE_FILE_MINOR;
+
+    return (version_get_file_major() << 8) | version_get_file_minor();
+}
+
+static boolean is_compatible(storage_handle store)
+{
+    int major = store->seg->file_version >> 8;
+    if (STORAGE_FLAGS(store) & ~KNOWN_FLAGS)
+	return FALSE;
+
+    if (major == BASE_FILE_MAJOR)
+	return STORAGE_FLAGS(store) == 0 && !HAS_ARENA(store) &&
+	    HIST_DEPTH(store) == 0 && !HAS_LOG(store);
+
+    return major == version_get_file_major();
+}
+
 static status init_create(storage_handle *pstore, const char *mmap_file,
 			  int open_flags, mode_t mode_flags, boolean persist,
 			  identifier base_id, identifier max_id,
 			  size_t value_size, size_t property_size,
-			  size_t q_capacity, const char *desc)
+			  size_t q_capacity, const char *desc,
+			  const struct storage_options *opts)
 {
     status st;
-    size_t rec_sz, hdr_sz, seg_sz, page_sz, prop_offset;
+    size_t rec_sz, hdr_sz, seg_sz, page_sz, prop_offset, arena_offset;
+    size_t len_offset, origin_offset, hist_offset, log_offset;
 
     BZERO(*pstore);
     (*pstore)->seg_fd = -1;
     (*pstore)->is_persistent = persist;
 
-    rec_sz = offsetof(struct record, val) +
-	ALIGNED_SIZE(value_size, DEFAULT_ALIGNMENT);
+    if (opts->flags & STORAGE_ATOMIC)
+	rec_sz = offsetof(struct record, val) + ATOMIC_CELL_SIZE;
+    else if (opts->flags & STORAGE_DOUBLE)
+	rec_sz = offsetof(struct record, val) + 2 * SLOT_SIZE(value_size);
+    else
+	rec_sz = offsetof(struct record, val) +
+	    ALIGNED_SIZE(value_size, DEFAULT_ALIGNMENT);
+
+    if (opts->flags & STORAGE_VARLEN) {
+	/* NB. the actual length of a value follows its maximum extent */
+	len_offset = rec_sz;
+	rec_sz += ALIGNED_SIZE(sizeof(size_t), DEFAULT_ALIGNMENT);
+    } else
+	len_offset = 0;
+
+    if (opts->flags & STORAGE_TRACED) {
+	origin_offset = rec_sz;
+	rec_sz += ALIGNED_SIZE(sizeof(microsec), DEFAULT_ALIGNMENT);
+    } else
+	origin_offset = 0;
 
-    if (property_size > 0) {
+    if (opts->arena_size > 0) {
+	/* NB. each record refers to its property within the arena */
+	prop_offset = rec_sz;
+	rec_sz += ALIGNED_SIZE(sizeof(struct property_ref), DEFAULT_ALIGNMENT);
+    } else if (property_size > 0) {
 	prop_offset = rec_sz;
 	rec_sz += ALIGNED_SIZE(property_size, DEFAULT_ALIGNMENT);
     } else
 	prop_offset = 0;
 
+    if (opts->history_depth > 0) {
+	if (opts->history_depth >
+	    ((size_t)-1 - rec_sz) / HIST_ENTRY_SIZE(value_size))
+	    return error_msg(INVALID_CAPACITY,
+			     "storage_create: history too deep "
+			     "for address space");
+
+	hist_offset = rec_sz;
+	rec_sz += opts->history_depth * HIST_ENTRY_SIZE(value_size);
+    } else
+	hist_offset = 0;
+
     hdr_sz = offsetof(struct segment, change_q) +
 	ALIGNED_SIZE(sizeof(identifier) *
 		     (q_capacity > 0 ? q_capacity : 1), DEFAULT_ALIGNMENT);
 
+    if (opts->log_capacity > 0) {
+	/* NB. the update log follows the change queue */
+	if (opts->log_capacity >
+	    ((size_t)-1 - hdr_sz) / 2 / LOG_ENTRY_SIZE(value_size))
+	    return error_msg(INVALID_CAPACITY,
+			     "storage_create: update log too large "
+			     "for address space");
+
+	log_offset = hdr_sz;
+	hdr_sz += opts->log_capacity * LOG_ENTRY_SIZE(value_size);
+    } else
+	log_offset = 0;
+
+    if (opts->flags & STORAGE_ATOMIC) {
+	/* NB. keep the cells of every record aligned */
+	rec_sz = ALIGNED_SIZE(rec_sz, ATOMIC_CELL_SIZE);
+	hdr_sz = ALIGNED_SIZE(hdr_sz, ATOMIC_CELL_SIZE);
+    }
+
     page_sz = sysconf(_SC_PAGESIZE);
-    seg_sz =
-	(hdr_sz + (rec_sz * (max_id - base_id)) + page_sz - 1) & ~(page_sz - 1);
+    if (opts->arena_size > ((size_t)-1 - hdr_sz - page_sz) ||
+	((size_t)(max_id - base_id) >
+	 (((size_t)-1 - hdr_sz - page_sz - opts->arena_size) / rec_sz)))
+	return error_msg(INVALID_CAPACITY,
+			 "storage_create: too many records for address space");
+
+    arena_offset = hdr_sz + rec_sz * (max_id - base_id);
+    seg_sz = (arena_offset + opts->arena_size + page_sz - 1) & ~(page_sz - 1);
+
+    if (opts->arena_size == 0)
+	arena_offset = 0;
 
     if (strncmp(mmap_file, "shm:", 4) == 0) {
 	(*pstore)->seg_fd = shm_open(mmap_file + 4, open_flags, mode_flags);
@@ -124,6 +533,9 @@ static status init_create(storage_handle *pstore, const char *mmap_file,
 	    return error_eintr("storage_create: open");
     }
 
+    if (FAILED(st = share_file(*pstore, "storage_create: flock")))
+	return st;
+
     if (open_flags & O_CREAT) {
         /* NB. Darwin allows a segment to be truncated only once */
         if (ftruncate((*pstore)->seg_fd, seg_sz) == -1) {
@@ -141,7 +553,7 @@ static status init_create(storage_handle *pstore, const char *mmap_file,
     }
 
     (*pstore)->seg = mmap(NULL, seg_sz, PROT_READ | PROT_WRITE,
-			  MAP_SHARED, (*pstore)->seg_fd, 0);
+			  mmap_share_flags(opts->flags), (*pstore)->seg_fd, 0);
 
     if ((*pstore)->seg == MAP_FAILED) {
 	(*pstore)->seg = NULL;
@@ -154,36 +566,55 @@ static status init_create(storage_handle *pstore, const char *mmap_file,
 	return NO_MEMORY;
 
     if (open_flags & O_CREAT) {
-	(*pstore)->seg->file_version =
-	    (version_get_file_major() << 8) | version_get_file_minor();
+	(*pstore)->seg->file_version = file_version_for(opts);
 
 	(*pstore)->seg->seg_size = seg_sz;
 	(*pstore)->seg->hdr_size = hdr_sz;
 	(*pstore)->seg->rec_size = rec_sz;
 	(*pstore)->seg->val_size = value_size;
-	(*pstore)->seg->prop_size = property_size;
+	(*pstore)->seg->prop_size = (arena_offset ? 0 : property_size);
 	(*pstore)->seg->ts_offset = offsetof(struct record, ts);
 	(*pstore)->seg->val_offset = offsetof(struct record, val);
 	(*pstore)->seg->prop_offset = prop_offset;
 	(*pstore)->seg->base_id = base_id;
 	(*pstore)->seg->max_id = max_id;
 	(*pstore)->seg->q_mask = q_capacity - 1;
+	STORAGE_FLAGS(*pstore) = opts->flags;
+	STORAGE_ARENA(*pstore).arena_size = opts->arena_size;
+	STORAGE_ARENA(*pstore).arena_offset = arena_offset;
+	STORAGE_ARENA(*pstore).arena_top = seg_sz;
+	(*pstore)->seg->new_fields.ext.len_offset = len_offset;
+	(*pstore)->seg->new_fields.ext.origin_offset = origin_offset;
+	(*pstore)->seg->new_fields.ext.hist_depth = opts->history_depth;
+	(*pstore)->seg->new_fields.ext.hist_offset = hist_offset;
+	UPDATE_LOG(*pstore).log_mask = opts->log_capacity - 1;
+	UPDATE_LOG(*pstore).log_offset = log_offset;
+	spin_create(&STORAGE_ARENA(*pstore).arena_lock);
+	spin_create(&(*pstore)->seg->new_fields.ext.epoch);
 
 	if (FAILED(st = storage_set_description(*pstore, desc)))
 	    return st;
     } else if (((*pstore)->seg->file_version >> 8) !=
-	       version_get_file_major())
+	       (file_version_for(opts) >> 8))
 	return error_msg(WRONG_FILE_VERSION,
 			 "storage_create: incompatible file version");
     else if ((*pstore)->seg->seg_size != seg_sz ||
 	     (*pstore)->seg->hdr_size != hdr_sz ||
 	     (*pstore)->seg->rec_size != rec_sz ||
 	     (*pstore)->seg->val_size != value_size ||
-	     (*pstore)->seg->prop_size != property_size ||
+	     (*pstore)->seg->prop_size != (arena_offset ? 0 : property_size) ||
 	     (*pstore)->seg->ts_offset != offsetof(struct record, ts) ||
 	     (*pstore)->seg->val_offset != offsetof(struct record, val) ||
 	     (*pstore)->seg->prop_offset != prop_offset ||
 	     (*pstore)->seg->q_mask != (q_capacity - 1) ||
+	     STORAGE_FLAGS(*pstore) != opts->flags ||
+	     STORAGE_ARENA(*pstore).arena_size != opts->arena_size ||
+	     STORAGE_ARENA(*pstore).arena_offset != arena_offset ||
+	     (*pstore)->seg->new_fields.ext.len_offset != len_offset ||
+	     (*pstore)->seg->new_fields.ext.origin_offset != origin_offset ||
+	     HIST_DEPTH(*pstore) != opts->history_depth ||
+	     UPDATE_LOG(*pstore).log_mask != (opts->log_capacity - 1) ||
+	     UPDATE_LOG(*pstore).log_offset != log_offset ||
 	     (!desc && (*pstore)->seg->description[0] != '\0') ||
 	     (desc && strcmp(desc, (*pstore)->seg->description) != 0))
 	return error_msg(STORAGE_UNEQUAL,
@@ -192,13 +623,21 @@ static status init_create(storage_handle *pstore, const char *mmap_file,
     (*pstore)->first = (void *)(((char *)(*pstore)->seg) + hdr_sz);
     (*pstore)->limit =
 	STORAGE_RECORD(*pstore, (*pstore)->first, max_id - base_id);
+    (*pstore)->cell_load = cell_load_method(*pstore);
 
     if ((open_flags & (O_CREAT | O_EXCL)) != (O_CREAT | O_EXCL)) {
-	record_handle r;
-	for (r = (*pstore)->first;
-	     r < (*pstore)->limit; r = STORAGE_RECORD(*pstore, r, 1))
-	    if (r->rev < 0)
-		r->rev &= ~SPIN_MASK;
+	record_handle r, end;
+	for (r = find_allocated(*pstore, (*pstore)->first, &end);
+	     r < (*pstore)->limit; r = find_allocated(*pstore, r, &end))
+	    for (; r < end; r = STORAGE_RECORD(*pstore, r, 1))
+		if (r->rev < 0)
+		    r->rev &= ~SPIN_MASK;
+
+	if (STORAGE_ARENA(*pstore).arena_lock < 0)
+	    STORAGE_ARENA(*pstore).arena_lock &= ~SPIN_MASK;
+
+	if ((*pstore)->seg->new_fields.ext.epoch < 0)
+	    (*pstore)->seg->new_fields.ext.epoch &= ~SPIN_MASK;
 
 	SYNC_SYNCHRONIZE();
     }
@@ -216,7 +655,9 @@ static status init_create(storage_handle *pstore, const char *mmap_file,
 static status init_open(storage_handle *pstore, const char *mmap_file,
 			int open_flags)
 {
+    status st;
     size_t seg_sz;
+    unsigned flags;
     struct stat file_stat;
     int mmap_flags = PROT_READ;
 
@@ -239,6 +680,9 @@ static status init_open(storage_handle *pstore, const char *mmap_file,
 	    return error_eintr("storage_open: open");
     }
 
+    if (FAILED(st = share_file(*pstore, "storage_open: flock")))
+	return st;
+
     if (fstat((*pstore)->seg_fd, &file_stat) == -1)
 	return error_errno("storage_open: fstat");
 
@@ -259,17 +703,18 @@ static status init_open(storage_handle *pstore, const char *mmap_file,
     if ((*pstore)->seg->magic != MAGIC_NUMBER)
 	return error_msg(STORAGE_CORRUPTED, "storage_open: storage is corrupt");
 
-    if (((*pstore)->seg->file_version >> 8) != version_get_file_major())
+    if (!is_compatible(*pstore))
 	return error_msg(WRONG_FILE_VERSION,
 			 "storage_open: incompatible file version");
 
     seg_sz = (*pstore)->seg->seg_size;
+    flags = STORAGE_FLAGS(*pstore);
 
     if (munmap((*pstore)->seg, (*pstore)->mmap_size) == -1)
 	return error_errno("storage_open: munmap");
 
-    (*pstore)->seg =
-	mmap(NULL, seg_sz, mmap_flags, MAP_SHARED, (*pstore)->seg_fd, 0);
+    (*pstore)->seg = mmap(NULL, seg_sz, mmap_flags, mmap_share_flags(flags),
+			  (*pstore)->seg_fd, 0);
 
     if ((*pstore)->seg == MAP_FAILED) {
 	(*pstore)->seg = NULL;
@@ -287,6 +732,7 @@ static status init_open(storage_handle *pstore, const char *mmap_file,
     (*pstore)->limit =
 	STORAGE_RECORD(*pstore, (*pstore)->first,
 		       (*pstore)->seg->max_id - (*pstore)->seg->base_id);
+    (*pstore)->cell_load = cell_load_method(*pstore);
     return OK;
 }
 
@@ -295,9 +741,34 @@ status storage_create(storage_handle *pstore, const char *mmap_file,
 		      identifier base_id, identifier max_id,
 		      size_t value_size, size_t property_size,
 		      size_t q_capacity, const char *desc)
+{
+    return storage_create2(pstore, mmap_file, open_flags, mode_flags,
+			   persist, base_id, max_id, value_size,
+			   property_size, q_capacity, desc, NULL);
+}
+
+status storage_create2(storage_handle *pstore, const char *mmap_file,
+		       int open_flags, mode_t mode_flags, boolean persist,
+		       identifier base_id, identifier max_id,
+		       size_t value_size, size_t property_size,
+		       size_t q_capacity, const char *desc,
+		       const struct storage_options *opts)
 {
     status st;
-    if (!pstore || !mmap_file || max_id <= base_id || value_size == 0)
+    struct storage_options defaults;
+
+    if (!opts) {
+	BZERO(&defaults);
+	opts = &defaults;
+    }
+
+    if (!pstore || !mmap_file || max_id <= base_id || value_size == 0 ||
+	(opts->flags & ~KNOWN_FLAGS) ||
+	(opts->arena_size > 0 && property_size > 0) ||
+	((opts->flags & STORAGE_ATOMIC) &&
+	 ((opts->flags & (STORAGE_VARLEN | STORAGE_DOUBLE)) ||
+	  value_size > ATOMIC_VALUE_SIZE)) ||
+	((opts->flags & STORAGE_DOUBLE) && (opts->flags & STORAGE_VARLEN)))
 	return error_invalid_arg("storage_create");
 
     /* NB. q_capacity must be zero or a non-zero power of 2 */
@@ -305,6 +776,16 @@ status storage_create(storage_handle *pstore, const char *mmap_file,
 	return error_msg(INVALID_CAPACITY,
 			 "storage_create: invalid queue capacity");
 
+    if (opts->log_capacity == 1 ||
+	(opts->log_capacity & (opts->log_capacity - 1)) != 0)
+	return error_msg(INVALID_CAPACITY,
+			 "storage_create: invalid update log capacity");
+
+    /* NB. so that the history ring stays in step when the revision wraps */
+    if ((opts->history_depth & (opts->history_depth - 1)) != 0)
+	return error_msg(INVALID_CAPACITY,
+			 "storage_create: invalid history depth");
+
     if ((open_flags & O_ACCMODE) != O_RDWR ||
 	open_flags & ~(O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW))
 	return error_msg(INVALID_OPEN_FLAGS,
@@ -320,7 +801,7 @@ status storage_create(storage_handle *pstore, const char *mmap_file,
 
     if (FAILED(st = init_create(pstore, mmap_file, open_flags, mode_flags,
 				persist, base_id, max_id, value_size,
-				property_size, q_capacity, desc))) {
+				property_size, q_capacity, desc, opts))) {
 	error_save_last();
 	storage_destroy(pstore);
 	error_restore_last();
@@ -422,6 +903,20 @@ status storage_set_data_version(storage_handle store, unsigned short data_ver)
     return OK;
 }
 
+unsigned storage_get_flags(storage_handle store)
+{
+    return STORAGE_FLAGS(store);
+}
+
+void storage_get_options(storage_handle store, struct storage_options *opts)
+{
+    BZERO(opts);
+    opts->flags = STORAGE_FLAGS(store);
+    opts->arena_size = STORAGE_ARENA(store).arena_size;
+    opts->history_depth = HIST_DEPTH(store);
+    opts->log_capacity = UPDATE_LOG(store).log_mask + 1;
+}
+
 const void *storage_get_segment(storage_handle store)
 {
     return store->seg;
@@ -561,6 +1056,41 @@ const q_index *storage_get_queue_head_ref(storage_handle store)
     return &store->seg->q_head;
 }
 
+status storage_time_now(storage_handle store, microsec *pnow)
+{
+    (void)store;
+    return clock_time_fast(pnow);
+}
+
+status storage_time_now_ns(storage_handle store, nanosec *pnow)
+{
+    (void)store;
+    return clock_time_ns(pnow);
+}
+
+status storage_get_fast_path(storage_handle store,
+			     struct storage_fast_path *fp)
+{
+    if (!fp)
+	return error_invalid_arg("storage_get_fast_path");
+
+    fp->store = store;
+    fp->first = (char *)store->first;
+    fp->rec_size = store->seg->rec_size;
+    fp->val_size = store->seg->val_size;
+    fp->base_id = store->seg->base_id;
+    fp->max_id = store->seg->max_id;
+    fp->q_mask = store->seg->q_mask;
+    fp->q_head = &store->seg->q_head;
+    fp->change_q = store->seg->change_q;
+    fp->is_read_only = store->is_read_only;
+    fp->is_plain = !IS_ATOMIC(store) && !IS_DOUBLE(store) &&
+	!IS_VARLEN(store) && !IS_TRACED(store) &&
+	HIST_DEPTH(store) == 0 && !HAS_LOG(store);
+
+    return OK;
+}
+
 size_t storage_get_queue_capacity(storage_handle store)
 {
     return store->seg->q_mask + 1;
@@ -587,6 +1117,30 @@ status storage_write_queue(storage_handle store, identifier id)
     return OK;
 }
 
+status storage_write_queue_batch(storage_handle store,
+				 const identifier *ids, size_t count)
+{
+    q_index head;
+    size_t n;
+
+    if (store->is_read_only)
+	return error_msg(STORAGE_READ_ONLY,
+			 "storage_write_queue_batch: storage is read-only");
+
+    if (store->seg->q_mask == (size_t) - 1)
+	return error_msg(NO_CHANGE_QUEUE,
+			 "storage_write_queue_batch: no change queue");
+
+    /* NB. the whole batch becomes visible to readers at once */
+    head = store->seg->q_head;
+    for (n = 0; n < count; ++n)
+	store->seg->change_q[(head + n) & store->seg->q_mask] = ids[n];
+
+    SYNC_SYNCHRONIZE();
+    store->seg->q_head = head + count;
+    return OK;
+}
+
 status storage_read_queue(storage_handle store, q_index idx,
 			  identifier *pident)
 {
@@ -601,6 +1155,96 @@ status storage_read_queue(storage_handle store, q_index idx,
     return OK;
 }
 
+void storage_prefetch_queue(storage_handle store, q_index idx)
+{
+#ifdef __GNUC__
+    size_t i;
+    if (store->seg->q_mask == (size_t) - 1)
+	return;
+
+    /* NB. an entry not yet written may hold any identifier */
+    i = store->seg->change_q[idx & store->seg->q_mask] - store->seg->base_id;
+    if (i < (size_t)(store->seg->max_id - store->seg->base_id))
+	__builtin_prefetch(STORAGE_RECORD(store, store->first, i));
+#else
+    (void)store;
+    (void)idx;
+#endif
+}
+
+size_t storage_get_log_capacity(storage_handle store)
+{
+    return UPDATE_LOG(store).log_mask + 1;
+}
+
+q_index storage_get_log_head(storage_handle store)
+{
+    return UPDATE_LOG(store).log_head;
+}
+
+status storage_read_log(storage_handle store, q_index idx,
+			identifier *pident, void *buf, size_t len,
+			revision *prev, microsec *pts)
+{
+    const struct log_entry *e;
+
+    if (!HAS_LOG(store))
+	return error_msg(NO_CHANGE_QUEUE, "storage_read_log: no update log");
+
+    e = LOG_ENTRY(store, idx);
+    if (len > store->seg->val_size)
+	len = store->seg->val_size;
+
+    if (pident)
+	*pident = e->id;
+
+    if (buf)
+	memcpy(buf, e->val, len);
+
+    if (prev)
+	*prev = e->rev;
+
+    if (pts)
+	*pts = e->ts;
+
+    /* NB. the entry may have been overwritten while it was copied */
+    if ((size_t)(UPDATE_LOG(store).log_head - idx) >
+	UPDATE_LOG(store).log_mask)
+	return error_msg(CHANGE_QUEUE_OVERRUN,
+			 "storage_read_log: update log overrun");
+
+    return OK;
+}
+
+revision storage_get_epoch(storage_handle store)
+{
+    return store->seg->new_fields.ext.epoch;
+}
+
+status storage_begin_commit(storage_handle store, revision *old_epoch)
+{
+    if (store->is_read_only)
+	return error_msg(STORAGE_READ_ONLY,
+			 "storage_begin_commit: storage is read-only");
+
+    return spin_write_lock(&store->seg->new_fields.ext.epoch, old_epoch);
+}
+
+status storage_commit(storage_handle store, revision old_epoch)
+{
+    if (store->is_read_only)
+	return error_msg(STORAGE_READ_ONLY,
+			 "storage_commit: storage is read-only");
+
+    spin_unlock(&store->seg->new_fields.ext.epoch, NEXT_REV(old_epoch));
+    return OK;
+}
+
+status storage_read_epoch(storage_handle store, revision *epoch)
+{
+    return spin_read_lock(&store->seg->new_fields.ext.epoch, epoch);
+}
+
 status storage_get_id(storage_handle store, record_handle rec,
 		      identifier *pident)
 {
@@ -647,25 +1291,32 @@ status storage_find_next_unused(storage_handle store, record_handle prior,
     } else
 	prior = store->first;
 
-    for (; prior < store->limit; prior = STORAGE_RECORD(store, prior, 1)) {
-	revision rev;
-	if (old_rev) {
-	    status st;
-	    if (FAILED(st = spin_write_lock(&prior->rev, &rev)))
-		return st;
-	} else
-	    rev = prior->rev;
+    while (prior < store->limit) {
+	record_handle end, next = find_allocated(store, prior, &end);
+	if (next > prior)
+	    end = STORAGE_RECORD(store, prior, 1);
+
+	/* NB. a record within a hole of a sparse storage is unused */
+	for (; prior < end; prior = STORAGE_RECORD(store, prior, 1)) {
+	    revision rev;
+	    if (old_rev) {
+		status st;
+		if (FAILED(st = spin_write_lock(&prior->rev, &rev)))
+		    return st;
+	    } else
+		rev = prior->rev;
+
+	    if (rev == 0) {
+		*prec = prior;
+		if (old_rev)
+		    *old_rev = rev;
+
+		return TRUE;
+	    }
 
-	if (rev == 0) {
-	    *prec = prior;
 	    if (old_rev)
-		*old_rev = rev;
-
-	    return TRUE;
+		spin_unlock(&prior->rev, rev);
 	}
-
-	if (old_rev)
-	    spin_unlock(&prior->rev, rev);
     }
 
     return FALSE;
@@ -684,30 +1335,39 @@ status storage_find_prev_used(storage_handle store, record_handle prior,
     if (prior) {
 	if (prior < store->first || prior >= store->limit)
 	    return error_invalid_arg("storage_find_prev_unused");
-
-	prior = STORAGE_RECORD(store, prior, -1);
     } else
-	prior = STORAGE_RECORD(store, store->limit, -1);
+	prior = store->limit;
 
-    for (; prior >= store->first; prior = STORAGE_RECORD(store, prior, -1)) {
-	revision rev;
-	if (old_rev) {
-	    status st;
-	    if (FAILED(st = spin_write_lock(&prior->rev, &rev)))
-		return st;
-	} else
-	    rev = prior->rev;
+    while (prior > store->first) {
+	record_handle begin, end = find_allocated_below(store, prior, &begin);
+	if (begin >= end)
+	    break;
 
-	if (rev != 0) {
-	    *prec = prior;
-	    if (old_rev)
-		*old_rev = rev;
+	/* NB. a record within a hole of a sparse storage is unused, and is
+	   neither read nor locked, lest its page be allocated */
+	for (prior = STORAGE_RECORD(store, end, -1); prior >= begin;
+	     prior = STORAGE_RECORD(store, prior, -1)) {
+	    revision rev;
+	    if (old_rev) {
+		status st;
+		if (FAILED(st = spin_write_lock(&prior->rev, &rev)))
+		    return st;
+	    } else
+		rev = prior->rev;
+
+	    if (rev != 0) {
+		*prec = prior;
+		if (old_rev)
+		    *old_rev = rev;
+
+		return TRUE;
+	    }
 
-	    return TRUE;
+	    if (old_rev)
+		spin_unlock(&prior->rev, rev);
 	}
 
-	if (old_rev)
-	    spin_unlock(&prior->rev, rev);
+	prior = begin;
     }
 
     return FALSE;
@@ -721,13 +1381,168 @@ status storage_iterate(storage_handle store, record_handle prior,
 	return error_invalid_arg("storage_iterate");
 
     for (prior = (prior ? STORAGE_RECORD(store, prior, 1) : store->first);
-	 prior < store->limit; prior = STORAGE_RECORD(store, prior, 1))
-	if (FAILED(st = iter_fn(store, prior, param)) || !st)
+	 prior < store->limit;) {
+	record_handle end;
+	for (prior = find_allocated(store, prior, &end);
+	     prior < end; prior = STORAGE_RECORD(store, prior, 1))
+	    if (FAILED(st = iter_fn(store, prior, param)) || !st)
+		return st;
+    }
+
+    return st;
+}
+
+struct scan_part {
+    storage_handle store;
+    record_handle begin;
+    record_handle end;
+    storage_iterate_func iter_fn;
+    void *param;
+    volatile boolean *stop;
+    status result;
+    struct error_state error;
+};
+
+static status scan_range(struct scan_part *part)
+{
+    status st = TRUE;
+    record_handle rec = part->begin;
+
+    while (rec < part->end && !*part->stop) {
+	record_handle end;
+	for (rec = find_allocated(part->store, rec, &end);
+	     rec < end && rec < part->end && !*part->stop;
+	     rec = STORAGE_RECORD(part->store, rec, 1))
+	    if (FAILED(st = part->iter_fn(part->store, rec, part->param)) ||
+		!st) {
+		*part->stop = TRUE;
+		return st;
+	    }
+    }
+
+    return st;
+}
+
+static void scan_part(struct scan_part *part)
+{
+    if (FAILED(part->result = scan_range(part)))
+	error_get_thread_last(&part->error);
+}
+
+static void *scan_func(thread_handle thr)
+{
+    scan_part(thread_get_param(thr));
+    return NULL;
+}
+
+status storage_iterate_parallel(storage_handle store, size_t worker_count,
+				storage_iterate_func iter_fn, void **params)
+{
+    struct scan_part *parts;
+    thread_handle *thrs;
+    volatile boolean stop = FALSE;
+    status st = OK;
+    size_t i, rec_count, chunk;
+
+    if (!iter_fn || worker_count == 0)
+	return error_invalid_arg("storage_iterate_parallel");
+
+    parts = xcalloc(worker_count, sizeof(struct scan_part));
+    thrs = xcalloc(worker_count, sizeof(thread_handle));
+    if (!parts || !thrs) {
+	xfree(parts);
+	xfree(thrs);
+	return NO_MEMORY;
+    }
+
+    rec_count = ((char *)store->limit - (char *)store->first) /
+	store->seg->rec_size;
+
+    chunk = (rec_count + worker_count - 1) / worker_count;
+
+    /* NB. each worker scans a contiguous part of the identifier range, so
+       per-worker results taken in worker order are in identifier order */
+    for (i = 0; i < worker_count; ++i) {
+	size_t lo = i * chunk, hi = lo + chunk;
+	if (lo > rec_count)
+	    lo = rec_count;
+
+	if (hi > rec_count)
+	    hi = rec_count;
+
+	parts[i].store = store;
+	parts[i].begin = STORAGE_RECORD(store, store->first, lo);
+	parts[i].end = STORAGE_RECORD(store, store->first, hi);
+	parts[i].iter_fn = iter_fn;
+	parts[i].param = params ? params[i] : NULL;
+	parts[i].stop = &stop;
+	parts[i].result = TRUE;
+    }
+
+    for (i = 1; i < worker_count; ++i)
+	if (FAILED(parts[i].result = thread_create(&thrs[i], scan_func,
+						   &parts[i]))) {
+	    error_get_thread_last(&parts[i].error);
+	    stop = TRUE;
 	    break;
+	}
+
+    /* NB. the calling thread scans the first part itself */
+    if (!stop)
+	scan_part(&parts[0]);
+
+    for (i = 1; i < worker_count; ++i)
+	if (thrs[i]) {
+	    if (FAILED(st = thread_stop(thrs[i], NULL)) &&
+		!FAILED(parts[i].result)) {
+		parts[i].result = st;
+		error_get_thread_last(&parts[i].error);
+	    }
+
+	    thread_destroy(&thrs[i]);
+	}
 
+    /* NB. the result, and any error, is that of the first worker to fail
+       or else the first to stop early, each worker's error having been
+       kept apart from those raised concurrently by the others */
+    st = TRUE;
+    for (i = 0; i < worker_count; ++i)
+	if (FAILED(parts[i].result)) {
+	    error_set_last(&parts[i].error);
+	    st = parts[i].result;
+	    break;
+	} else if (!parts[i].result && st)
+	    st = FALSE;
+
+    xfree(parts);
+    xfree(thrs);
     return st;
 }
 
+status storage_find_allocated(storage_handle store, identifier id,
+			      identifier *plow, identifier *phigh)
+{
+    record_handle rec, end;
+    if (!plow || !phigh)
+	return error_invalid_arg("storage_find_allocated");
+
+    if (id < store->seg->base_id || id >= store->seg->max_id)
+	return error_msg(INVALID_RECORD,
+			 "storage_find_allocated: invalid identifier");
+
+    rec = find_allocated(store, STORAGE_RECORD(store, store->first,
+					       id - store->seg->base_id),
+			 &end);
+
+    *plow = store->seg->base_id +
+	((char *)rec - (char *)store->first) / store->seg->rec_size;
+
+    *phigh = store->seg->base_id +
+	((char *)end - (char *)store->first) / store->seg->rec_size;
+
+    return OK;
+}
+
 status storage_sync(storage_handle store)
 {
     if (store->is_read_only)
@@ -747,13 +1562,39 @@ status storage_reset(storage_handle store)
 	return error_msg(STORAGE_READ_ONLY,
 			 "storage_reset: storage is read-only");
 
-    memset(store->first, 0, (char *)store->limit - (char *)store->first);
+#ifdef MADV_REMOVE
+    if (IS_SPARSE(store)) {
+	/* NB. release the pages of records rather than zeroing them */
+	size_t page_sz = sysconf(_SC_PAGESIZE);
+	char *page = (char *)store->seg +
+	    ((store->seg->hdr_size + page_sz - 1) & ~(page_sz - 1));
+
+	if (page > (char *)store->limit)
+	    page = (char *)store->limit;
+
+	memset(store->first, 0, page - (char *)store->first);
+
+	if (page < (char *)store->limit &&
+	    madvise(page, (char *)store->seg + store->seg->seg_size - page,
+		    MADV_REMOVE) == -1)
+	    memset(page, 0, (char *)store->limit - page);
+    } else
+#endif
+	memset(store->first, 0, (char *)store->limit - (char *)store->first);
+
+    if (HAS_ARENA(store))
+	STORAGE_ARENA(store).arena_top = store->seg->seg_size;
 
     store->seg->q_head = 0;
     if (store->seg->q_mask != (size_t) - 1)
 	memset(store->seg->change_q, 0,
 	       (store->seg->q_mask + 1) * sizeof(identifier));
 
+    UPDATE_LOG(store).log_head = 0;
+    if (HAS_LOG(store))
+	memset(LOG_ENTRY(store, 0), 0, (UPDATE_LOG(store).log_mask + 1) *
+	       LOG_ENTRY_SIZE(store->seg->val_size));
+
     SYNC_SYNCHRONIZE();
     return OK;
 }
@@ -771,20 +1612,122 @@ status storage_delete(const char *mmap_file, boolean force)
     return OK;
 }
 
+struct grow_part {
+    storage_handle new_store;
+    size_t val_copy_sz;
+    size_t prop_copy_sz;
+    void *val_copy_buf;
+    void *prop_copy_buf;
+};
+
+static status grow_record(storage_handle store, record_handle old_r,
+			  void *param)
+{
+    struct grow_part *part = param;
+    storage_handle new_store = part->new_store;
+    record_handle new_r;
+    revision rev;
+    size_t val_len = 0;
+    microsec origin = 0;
+    status st;
+
+    new_r = STORAGE_RECORD(new_store, new_store->first,
+			   ((char *)old_r - (char *)store->first) /
+			   store->seg->rec_size);
+
+    /* NB. records beyond the new storage's range are dropped */
+    if (new_r >= new_store->limit)
+	return TRUE;
+
+    do {
+	if (FAILED(st = record_read_lock(old_r, &rev)))
+	    return st;
+
+	if (IS_DOUBLE(store)) {
+	    memcpy(part->val_copy_buf, old_r, offsetof(struct record, val));
+	    memcpy((char *)part->val_copy_buf + offsetof(struct record, val),
+		   CURRENT_SLOT(store, old_r, rev),
+		   part->val_copy_sz - offsetof(struct record, val));
+	} else
+	    memcpy(part->val_copy_buf, old_r, part->val_copy_sz);
+
+	if (IS_VARLEN(store))
+	    val_len = VALUE_LENGTH(store, old_r);
+
+	if (IS_TRACED(store))
+	    origin = ORIGIN_TIME(store, old_r);
+
+	if (part->prop_copy_sz > 0)
+	    memcpy(part->prop_copy_buf,
+		   (char *)old_r + store->seg->prop_offset,
+		   part->prop_copy_sz);
+    } while (rev != record_get_revision(old_r));
+
+    if (HAS_ARENA(store) && PROPERTY_REF(store, old_r)->size > 0) {
+	size_t sz = PROPERTY_REF(store, old_r)->size;
+	if (FAILED(st = storage_resize_property(new_store, new_r, sz)))
+	    return st;
+
+	memcpy(storage_get_property_ref(new_store, new_r),
+	       storage_get_property_ref(store, old_r), sz);
+    }
+
+    /* NB. leave the pages of unused records unallocated */
+    if (rev == 0 && IS_SPARSE(new_store))
+	return TRUE;
+
+    if (IS_DOUBLE(new_store)) {
+	memcpy(new_r, part->val_copy_buf, offsetof(struct record, val));
+	fill_slots(new_store, new_r,
+		   (char *)part->val_copy_buf + offsetof(struct record, val),
+		   part->val_copy_sz - offsetof(struct record, val),
+		   new_r->ts);
+    } else
+	memcpy(new_r, part->val_copy_buf, part->val_copy_sz);
+
+    if (IS_VARLEN(new_store))
+	VALUE_LENGTH(new_store, new_r) =
+	    (val_len < new_store->seg->val_size
+	     ? val_len : new_store->seg->val_size);
+
+    if (IS_TRACED(new_store))
+	ORIGIN_TIME(new_store, new_r) = origin;
+
+    if (part->prop_copy_sz > 0)
+	memcpy((char *)new_r + new_store->seg->prop_offset,
+	       part->prop_copy_buf, part->prop_copy_sz);
+
+    if (HIST_DEPTH(new_store) > 0)
+	copy_history(store, old_r, new_store, new_r);
+
+    return TRUE;
+}
+
 status storage_grow(storage_handle store, storage_handle *pnewstore,
 		    const char *new_mmap_file, int open_flags,
 		    identifier new_base_id, identifier new_max_id,
 		    size_t new_value_size, size_t new_property_size,
 		    size_t new_q_capacity)
+{
+    return storage_grow2(store, pnewstore, new_mmap_file, open_flags,
+			 new_base_id, new_max_id, new_value_size,
+			 new_property_size, new_q_capacity, 1);
+}
+
+status storage_grow2(storage_handle store, storage_handle *pnewstore,
+		     const char *new_mmap_file, int open_flags,
+		     identifier new_base_id, identifier new_max_id,
+		     size_t new_value_size, size_t new_property_size,
+		     size_t new_q_capacity, size_t worker_count)
 {
     status st;
-    revision rev;
-    size_t val_copy_sz, prop_copy_sz;
-    record_handle old_r, new_r;
-    void *val_copy_buf, *prop_copy_buf;
+    size_t i, val_copy_sz, prop_copy_sz = 0;
+    struct grow_part *parts;
+    void **params;
+    struct storage_options opts;
     struct stat file_stat;
 
-    if (!pnewstore || !new_mmap_file ||
+    if (!pnewstore || !new_mmap_file || worker_count == 0 ||
 	strcmp(new_mmap_file, store->mmap_file) == 0)
 	return error_invalid_arg("storage_grow");
 
@@ -796,50 +1739,72 @@ status storage_grow(storage_handle store, storage_handle *pnewstore,
     if (fstat(store->seg_fd, &file_stat) == -1)
 	return error_errno("storage_grow: fstat");
 
-    if (FAILED(st = storage_create(pnewstore, new_mmap_file,
-				   O_RDWR | open_flags,
-				   file_stat.st_mode, FALSE,
-				   new_base_id, new_max_id,
-				   new_value_size, new_property_size,
-				   new_q_capacity,
-				   storage_get_description(store))))
-	return st;
+    storage_get_options(store, &opts);
 
-    val_copy_sz = sizeof(revision) + sizeof(microsec) +
-	(store->seg->val_size < (*pnewstore)->seg->val_size
-	 ? store->seg->val_size : (*pnewstore)->seg->val_size);
+    /* NB. the properties of a storage with an arena are carried over */
+    if (opts.arena_size > 0 && new_property_size > 0)
+	return error_msg(INVALID_CAPACITY,
+			 "storage_grow: storage has an arena instead of "
+			 "fixed-size properties");
+
+    if (FAILED(st = storage_create2(pnewstore, new_mmap_file,
+				    O_RDWR | open_flags,
+				    file_stat.st_mode, FALSE,
+				    new_base_id, new_max_id,
+				    new_value_size, new_property_size,
+				    new_q_capacity,
+				    storage_get_description(store), &opts)))
+	return st;
 
-    val_copy_buf = alloca(val_copy_sz);
+    if (IS_ATOMIC(store))
+	val_copy_sz = offsetof(struct record, val) + ATOMIC_CELL_SIZE;
+    else
+	val_copy_sz = sizeof(revision) + sizeof(microsec) +
+	    (store->seg->val_size < (*pnewstore)->seg->val_size
+	     ? store->seg->val_size : (*pnewstore)->seg->val_size);
 
-    if (new_property_size > 0) {
+    if (new_property_size > 0)
 	prop_copy_sz = (store->seg->prop_size < (*pnewstore)->seg->prop_size
 			? store->seg->prop_size : (*pnewstore)->seg->prop_size);
 
-	prop_copy_buf = alloca(prop_copy_sz);
+    /* NB. each worker copies a part of the records into its own buffers */
+    parts = xcalloc(worker_count, sizeof(struct grow_part));
+    params = xcalloc(worker_count, sizeof(void *));
+    if (!parts || !params) {
+	xfree(parts);
+	xfree(params);
+	return NO_MEMORY;
     }
 
-    for (old_r = store->first, new_r = (*pnewstore)->first;
-	 old_r < store->limit && new_r < (*pnewstore)->limit;
-	 old_r = STORAGE_RECORD(store, old_r, 1),
-	     new_r = STORAGE_RECORD(*pnewstore, new_r, 1)) {
-	do {
-	    if (FAILED(st = record_read_lock(old_r, &rev)))
-		return st;
-
-	    memcpy(val_copy_buf, old_r, val_copy_sz);
+    for (i = 0; i < worker_count; ++i) {
+	parts[i].new_store = *pnewstore;
+	parts[i].val_copy_sz = val_copy_sz;
+	parts[i].prop_copy_sz = prop_copy_sz;
+	params[i] = &parts[i];
 
-	    if (new_property_size > 0)
-		memcpy(prop_copy_buf, (char *)old_r + store->seg->prop_offset,
-		       prop_copy_sz);
-	} while (rev != record_get_revision(old_r));
+	if (!(parts[i].val_copy_buf = xmalloc(val_copy_sz)) ||
+	    (prop_copy_sz > 0 &&
+	     !(parts[i].prop_copy_buf = xmalloc(prop_copy_sz)))) {
+	    st = NO_MEMORY;
+	    break;
+	}
+    }
 
-	memcpy(new_r, val_copy_buf, val_copy_sz);
+    if (!FAILED(st))
+	st = storage_iterate_parallel(store, worker_count, grow_record,
+				      params);
 
-	if (new_property_size > 0)
-	    memcpy((char *)new_r + (*pnewstore)->seg->prop_offset,
-		   prop_copy_buf, prop_copy_sz);
+    for (i = 0; i < worker_count; ++i) {
+	xfree(parts[i].val_copy_buf);
+	xfree(parts[i].prop_copy_buf);
     }
 
+    xfree(parts);
+    xfree(params);
+
+    if (FAILED(st))
+	return st;
+
     (*pnewstore)->seg->data_version = store->seg->data_version;
     strcpy((*pnewstore)->seg->description, store->seg->description);
 
@@ -866,12 +1831,33 @@ status storage_clear_record(storage_handle store, record_handle rec)
 	return error_msg(INVALID_RECORD,
 			 "storage_clear_record: invalid record address");
 
-    memset(rec->val, 0, store->seg->val_size);
+    if (IS_ATOMIC(store)) {
+	int64_t words[2];
+	words[0] = words[1] = 0;
+	store_cell(rec->val, words);
+    } else if (IS_DOUBLE(store))
+	memset(rec->val, 0, 2 * SLOT_SIZE(store->seg->val_size));
+    else
+	memset(rec->val, 0, store->seg->val_size);
 
-    if (store->seg->prop_size > 0)
+    if (HAS_ARENA(store)) {
+	status st;
+	if (FAILED(st = storage_resize_property(store, rec, 0)))
+	    return st;
+    } else if (store->seg->prop_size > 0)
 	memset((char *)rec + store->seg->prop_offset, 0,
 	       store->seg->prop_size);
 
+    if (IS_VARLEN(store))
+	VALUE_LENGTH(store, rec) = 0;
+
+    if (IS_TRACED(store))
+	ORIGIN_TIME(store, rec) = 0;
+
+    if (HIST_DEPTH(store) > 0)
+	memset(HIST_ENTRY_AT(store, rec, 0), 0,
+	       HIST_DEPTH(store) * HIST_ENTRY_SIZE(store->seg->val_size));
+
     rec->ts = 0;
     spin_unlock(&rec->rev, 0);
     return OK;
@@ -891,32 +1877,512 @@ status storage_copy_record(storage_handle from_store, record_handle from_rec,
 			 "storage_copy_record: invalid record address");
 
     if (from_store->seg->val_size != to_store->seg->val_size ||
-	(with_prop && from_store->seg->prop_size != to_store->seg->prop_size))
+	IS_VARLEN(from_store) != IS_VARLEN(to_store) ||
+	(with_prop && (from_store->seg->prop_size != to_store->seg->prop_size ||
+		       HAS_ARENA(from_store) != HAS_ARENA(to_store))))
 	return error_msg(STORAGE_UNEQUAL,
 			 "storage_copy_record: storage is unequal");
 
-    memcpy(to_rec->val, from_rec->val, from_store->seg->val_size);
+    if (with_prop && HAS_ARENA(from_store)) {
+	status st;
+	size_t sz = PROPERTY_REF(from_store, from_rec)->size;
+	if (FAILED(st = storage_resize_property(to_store, to_rec, sz)))
+	    return st;
+
+	if (sz > 0)
+	    memcpy(storage_get_property_ref(to_store, to_rec),
+		   storage_get_property_ref(from_store, from_rec), sz);
+    }
+
+    if (IS_ATOMIC(to_store)) {
+	int64_t words[2];
+	words[0] = 0;
+	memcpy(words, locked_value_ref(from_store, from_rec),
+	       from_store->seg->val_size);
+	words[1] = from_rec->rev & ~SPIN_MASK;
+	store_cell(to_rec->val, words);
+    } else if (IS_DOUBLE(to_store))
+	/* NB. the copy is current whatever revision it is later given */
+	fill_slots(to_store, to_rec, locked_value_ref(from_store, from_rec),
+		   from_store->seg->val_size, to_ts);
+    else
+	memcpy(to_rec->val, locked_value_ref(from_store, from_rec),
+	       from_store->seg->val_size);
+    if (IS_VARLEN(to_store))
+	VALUE_LENGTH(to_store, to_rec) = VALUE_LENGTH(from_store, from_rec);
+
+    if (IS_TRACED(to_store))
+	ORIGIN_TIME(to_store, to_rec) =
+	    storage_get_origin_time(from_store, from_rec);
 
     if (with_prop && from_store->seg->prop_size > 0)
 	memcpy((char *)to_rec + to_store->seg->prop_offset,
 	       (char *)from_rec + from_store->seg->prop_offset,
 	       from_store->seg->prop_size);
 
+    if (HIST_DEPTH(to_store) > 0)
+	copy_history(from_store, from_rec, to_store, to_rec);
+
     to_rec->ts = to_ts;
     return OK;
 }
 
 void *storage_get_property_ref(storage_handle store, record_handle rec)
 {
+    if (HAS_ARENA(store)) {
+	size_t offset = PROPERTY_REF(store, rec)->offset;
+	return offset ? ((char *)store->seg + offset) : NULL;
+    }
+
     return store->seg->prop_offset
 	? ((char *)rec + store->seg->prop_offset) : NULL;
 }
 
+size_t storage_get_property_length(storage_handle store, record_handle rec)
+{
+    return HAS_ARENA(store)
+	? PROPERTY_REF(store, rec)->size : store->seg->prop_size;
+}
+
+size_t storage_get_arena_size(storage_handle store)
+{
+    return HAS_ARENA(store)
+	? store->seg->seg_size - STORAGE_ARENA(store).arena_offset : 0;
+}
+
+size_t storage_get_arena_used(storage_handle store)
+{
+    return HAS_ARENA(store)
+	? store->seg->seg_size - STORAGE_ARENA(store).arena_top : 0;
+}
+
+static struct arena_tag *arena_get_tag(storage_handle store,
+				       const struct property_ref *ref)
+{
+    return (struct arena_tag *)((char *)store->seg + ref->offset +
+				ALIGNED_SIZE(ref->size, DEFAULT_ALIGNMENT));
+}
+
+status storage_resize_property(storage_handle store, record_handle rec,
+			       size_t new_size)
+{
+    status st;
+    struct property_ref *ref;
+    struct arena_tag *tag;
+    size_t total, top;
+
+    if (!HAS_ARENA(store))
+	return error_invalid_arg("storage_resize_property");
+
+    if (store->is_read_only)
+	return error_msg(STORAGE_READ_ONLY,
+			 "storage_resize_property: storage is read-only");
+
+    if (rec < store->first || rec >= store->limit)
+	return error_msg(INVALID_RECORD,
+			 "storage_resize_property: invalid record address");
+
+    ref = PROPERTY_REF(store, rec);
+    if (new_size == ref->size)
+	return OK;
+
+    if (FAILED(st = spin_write_lock(&STORAGE_ARENA(store).arena_lock, NULL)))
+	return st;
+
+    if (new_size == 0) {
+	tag = arena_get_tag(store, ref);
+
+	/* NB. a block at the top of the arena is reclaimed at once */
+	if (ref->offset == STORAGE_ARENA(store).arena_top)
+	    STORAGE_ARENA(store).arena_top += tag->total;
+	else
+	    tag->owner = 0;
+
+	ref->offset = ref->size = 0;
+	goto finish;
+    }
+
+    total = ALIGNED_SIZE(new_size, DEFAULT_ALIGNMENT) +
+	sizeof(struct arena_tag);
+
+    top = STORAGE_ARENA(store).arena_top;
+    if (total > top - STORAGE_ARENA(store).arena_offset) {
+	st = error_msg(STORAGE_FULL,
+		       "storage_resize_property: arena is full");
+	goto finish;
+    }
+
+    top -= total;
+    tag = (struct arena_tag *)((char *)store->seg + top + total -
+			       sizeof(struct arena_tag));
+
+    tag->total = total;
+    tag->owner = 1 + ((char *)rec - (char *)store->first) /
+	store->seg->rec_size;
+
+    if (ref->offset) {
+	memcpy((char *)store->seg + top, (char *)store->seg + ref->offset,
+	       ref->size < new_size ? ref->size : new_size);
+
+	arena_get_tag(store, ref)->owner = 0;
+    }
+
+    if (new_size > ref->size)
+	memset((char *)store->seg + top + ref->size, 0, new_size - ref->size);
+
+    STORAGE_ARENA(store).arena_top = top;
+    ref->offset = top;
+    ref->size = new_size;
+
+finish:
+    spin_unlock(&STORAGE_ARENA(store).arena_lock, 0);
+    return st;
+}
+
+status storage_compact_arena(storage_handle store)
+{
+    status st;
+    size_t src_end, dest;
+
+    if (!HAS_ARENA(store))
+	return OK;
+
+    if (store->is_read_only)
+	return error_msg(STORAGE_READ_ONLY,
+			 "storage_compact_arena: storage is read-only");
+
+    /* NB. other handles may refer to properties in place while they are
+       being moved, so compaction requires exclusive use of the storage */
+    if (flock(store->seg_fd, LOCK_EX | LOCK_NB) == -1) {
+	if (errno != EWOULDBLOCK)
+	    return error_eintr("storage_compact_arena: flock");
+
+	/* NB. a failed conversion may have released the shared lock */
+	if (FAILED(st = share_file(store, "storage_compact_arena: flock")))
+	    return st;
+
+	return error_msg(BLOCKED, "storage_compact_arena: storage is in use");
+    }
+
+    if (FAILED(st = spin_write_lock(&STORAGE_ARENA(store).arena_lock, NULL))) {
+	error_save_last();
+	share_file(store, "storage_compact_arena: flock");
+	error_restore_last();
+	return st;
+    }
+
+    /* NB. walk down from the end of the arena, sliding live blocks up */
+    src_end = dest = store->seg->seg_size;
+
+    while (src_end > STORAGE_ARENA(store).arena_top) {
+	struct arena_tag *tag = (struct arena_tag *)
+	    ((char *)store->seg + src_end - sizeof(struct arena_tag));
+	size_t total = tag->total, owner = tag->owner;
+
+	src_end -= total;
+	if (owner == 0)
+	    continue;
+
+	dest -= total;
+	if (dest != src_end) {
+	    memmove((char *)store->seg + dest,
+		    (char *)store->seg + src_end, total);
+
+	    PROPERTY_REF(store, STORAGE_RECORD(store, store->first,
+					       owner - 1))->offset = dest;
+	}
+    }
+
+    STORAGE_ARENA(store).arena_top = dest;
+    spin_unlock(&STORAGE_ARENA(store).arena_lock, 0);
+    return share_file(store, "storage_compact_arena: flock");
+}
+
 void *record_get_value_ref(record_handle rec)
 {
     return rec->val;
 }
 
+void *storage_get_value_ref(storage_handle store, record_handle rec)
+{
+    return IS_DOUBLE(store) ? NULL : rec->val;
+}
+
+size_t storage_get_value_length(storage_handle store, record_handle rec)
+{
+    if (IS_VARLEN(store)) {
+	size_t len = VALUE_LENGTH(store, rec);
+	return len < store->seg->val_size ? len : store->seg->val_size;
+    }
+
+    return store->seg->val_size;
+}
+
+status storage_set_value_length(storage_handle store, record_handle rec,
+				size_t len)
+{
+    if (len > store->seg->val_size ||
+	(!IS_VARLEN(store) && len != store->seg->val_size))
+	return error_invalid_arg("storage_set_value_length");
+
+    if (IS_VARLEN(store))
+	VALUE_LENGTH(store, rec) = len;
+
+    return OK;
+}
+
+microsec storage_get_origin_time(storage_handle store, record_handle rec)
+{
+    return IS_TRACED(store) ? ORIGIN_TIME(store, rec) : rec->ts;
+}
+
+status storage_set_origin_time(storage_handle store, record_handle rec,
+			       microsec when)
+{
+    if (!IS_TRACED(store))
+	return error_invalid_arg("storage_set_origin_time");
+
+    ORIGIN_TIME(store, rec) = when;
+    return OK;
+}
+
+status storage_read_value(storage_handle store, record_handle rec,
+			  void *buf, size_t len, revision *prev, microsec *pts)
+{
+    status st;
+    revision rev;
+
+    if (len > store->seg->val_size)
+	len = store->seg->val_size;
+
+    if (store->cell_load != CELL_LOAD_LOCKED) {
+	int64_t words[2];
+	load_cell(store, rec->val, words);
+
+	if (buf)
+	    memcpy(buf, words, len);
+
+	/* NB. the timestamp may be that of a later revision */
+	if (pts)
+	    *pts = rec->ts;
+
+	if (prev)
+	    *prev = words[1];
+
+	return OK;
+    }
+
+    if (IS_DOUBLE(store))
+	for (;;) {
+	    /* NB. a writer fills the other slot, so the current slot can
+	       only change under a reader after a second write has begun */
+	    revision now_rev;
+	    const char *slot;
+
+	    rev = rec->rev & ~SPIN_MASK;
+	    slot = CURRENT_SLOT(store, rec, rev);
+
+	    if (buf)
+		storage_copy_value(buf, slot, len);
+
+	    if (pts)
+		*pts = SLOT_TIME(store, slot);
+
+	    now_rev = rec->rev;
+	    if ((now_rev & ~SPIN_MASK) == rev || now_rev == NEXT_REV(rev)) {
+		if (prev)
+		    *prev = rev;
+
+		return OK;
+	    }
+	}
+
+    do {
+	if (FAILED(st = record_read_lock(rec, &rev)))
+	    return st;
+
+	if (buf)
+	    storage_copy_value(buf, rec->val, len);
+
+	if (pts)
+	    *pts = rec->ts;
+    } while (rev != rec->rev);
+
+    if (prev)
+	*prev = rev;
+
+    return OK;
+}
+
+status storage_store_value(storage_handle store, record_handle rec,
+			   const void *val, size_t len, microsec ts,
+			   revision new_rev)
+{
+    /* NB. a value stored afresh originates now */
+    return storage_store_value2(store, rec, val, len, ts, ts, new_rev);
+}
+
+status storage_store_value2(storage_handle store, record_handle rec,
+			    const void *val, size_t len, microsec ts,
+			    microsec origin, revision new_rev)
+{
+    char *dest;
+    if (len > store->seg->val_size)
+	return error_invalid_arg("storage_store_value");
+
+    rec->ts = ts;
+
+    /* NB. the origin must be written before an atomic storage publishes
+       the value and revision below, lest a reader pair them with the
+       origin of the previous value */
+    if (IS_TRACED(store))
+	ORIGIN_TIME(store, rec) = origin;
+
+    if (IS_ATOMIC(store)) {
+	int64_t words[2];
+	memcpy(words, rec->val, ATOMIC_VALUE_SIZE);
+	memcpy(words, val, len);
+	words[1] = new_rev;
+	store_cell(rec->val, words);
+	dest = rec->val;
+    } else if (IS_DOUBLE(store)) {
+	dest = VALUE_SLOT(store, rec, new_rev & 1);
+	storage_copy_value(dest, val, len);
+
+	if (len < store->seg->val_size)
+	    memcpy(dest + len, VALUE_SLOT(store, rec, (~new_rev) & 1) + len,
+		   store->seg->val_size - len);
+
+	SLOT_TIME(store, dest) = ts;
+    } else {
+	dest = rec->val;
+	storage_copy_value(dest, val, len);
+
+	if (IS_VARLEN(store)) {
+	    memset(dest + len, 0, store->seg->val_size - len);
+	    VALUE_LENGTH(store, rec) = len;
+	}
+    }
+
+    if (HAS_LOG(store)) {
+	q_index idx = UPDATE_LOG(store).log_head;
+	struct log_entry *e = LOG_ENTRY(store, idx);
+
+	e->id = store->seg->base_id +
+	    ((char *)rec - (char *)store->first) / store->seg->rec_size;
+	e->rev = new_rev;
+	e->ts = ts;
+	storage_copy_value(e->val, dest, store->seg->val_size);
+
+	SYNC_SYNCHRONIZE();
+	UPDATE_LOG(store).log_head = idx + 1;
+    }
+
+    if (HIST_DEPTH(store) > 0) {
+	/* NB. readers see the entry only once the revision is released */
+	struct history_entry *e = HIST_ENTRY(store, rec, new_rev);
+	e->rev = new_rev;
+	e->ts = ts;
+	storage_copy_value(e->val, dest, store->seg->val_size);
+    }
+
+    return OK;
+}
+
+status storage_view_value(storage_handle store, record_handle rec,
+			  storage_view_func view_fn, void *param)
+{
+    status st;
+    revision rev;
+
+    if (!view_fn)
+	return error_invalid_arg("storage_view_value");
+
+    if (store->cell_load != CELL_LOAD_LOCKED) {
+	/* NB. a cell is too small to be worth viewing in place */
+	int64_t words[2];
+	load_cell(store, rec->val, words);
+	return view_fn(store, rec, words, store->seg->val_size, words[1],
+		       rec->ts, param);
+    }
+
+    if (IS_DOUBLE(store))
+	for (;;) {
+	    revision now_rev;
+	    const char *slot;
+
+	    rev = rec->rev & ~SPIN_MASK;
+	    slot = CURRENT_SLOT(store, rec, rev);
+
+	    if (FAILED(st = view_fn(store, rec, slot, store->seg->val_size,
+				    rev, SLOT_TIME(store, slot), param)))
+		return st;
+
+	    now_rev = rec->rev;
+	    if ((now_rev & ~SPIN_MASK) == rev || now_rev == NEXT_REV(rev))
+		return st;
+	}
+
+    do {
+	if (FAILED(st = record_read_lock(rec, &rev)) ||
+	    FAILED(st = view_fn(store, rec, rec->val,
+				storage_get_value_length(store, rec),
+				rev, rec->ts, param)))
+	    return st;
+    } while (rev != rec->rev);
+
+    return st;
+}
+
+size_t storage_get_history_depth(storage_handle store)
+{
+    return HIST_DEPTH(store);
+}
+
+status storage_read_history(storage_handle store, record_handle rec,
+			    void *values, size_t copy_size, revision *revs,
+			    microsec *times, size_t count)
+{
+    size_t n, val_sz;
+    revision latest;
+
+    if (count == 0 || (!values && !revs && !times) ||
+	(values && copy_size == 0))
+	return error_invalid_arg("storage_read_history");
+
+    if (HIST_DEPTH(store) == 0)
+	return 0;
+
+    val_sz = (copy_size < store->seg->val_size
+	      ? copy_size : store->seg->val_size);
+
+    latest = rec->rev & ~SPIN_MASK;
+
+    for (n = 0; n < count && (size_t)latest > n; ++n) {
+	revision rev = latest - n, now_rev;
+	struct history_entry *e = HIST_ENTRY(store, rec, rev);
+
+	if (values)
+	    memcpy((char *)values + n * copy_size, e->val, val_sz);
+
+	if (times)
+	    times[n] = e->ts;
+
+	/* NB. an entry is overwritten by the revision one ring later */
+	now_rev = rec->rev;
+	if (now_rev < 0)
+	    now_rev = NEXT_REV(now_rev & ~SPIN_MASK);
+
+	if (e->rev != rev || (size_t)(now_rev - rev) >= HIST_DEPTH(store))
+	    break;
+
+	if (revs)
+	    revs[n] = rev;
+    }
+
+    return (status)n;
+}
+
 microsec record_get_timestamp(record_handle rec)
 {
     return rec->ts;
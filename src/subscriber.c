@@ -12,6 +12,7 @@
 #include <lancaster/reporter.h>
 #include <lancaster/signals.h>
 #include <lancaster/socket.h>
+#include <lancaster/statseg.h>
 #include <lancaster/thread.h>
 #include <lancaster/version.h>
 #include <signal.h>
@@ -23,16 +24,18 @@
 
 #define DEFAULT_TOUCH_USEC (1 * 1000000)
 #define DISPLAY_DELAY_USEC (1 * 1000000)
+#define TOTALS_DELAY_USEC (100 * 1000)
 
 static receiver_handle rcvr;
 static reporter_handle reporter;
+static statseg_handle statseg;
 static char hostname[256];
 static boolean as_json;
 
 static void show_syntax(void)
 {
     fprintf(stderr, "Syntax: %s [-v] [-H MAX-MISSED-HEARTBEATS] [-j] [-L] "
-	    "[-p ERROR PREFIX] [-q CHANGE-QUEUE-CAPACITY] "
+	    "[-M STATISTICS-SEGMENT] [-p ERROR PREFIX] [-q CHANGE-QUEUE-CAPACITY] "
 	    "[-S STATISTICS-UDP-ADDRESS:PORT] [-T TOUCH-PERIOD] STORAGE-FILE "
 	    "TCP-ADDRESS:PORT\n", error_get_program_name());
 
@@ -61,7 +64,11 @@ static status output_json(double secs, microsec now, const char *alias)
 		"\"min/us\":%.2f, "
 		"\"avg/us\":%.2f, "
 		"\"max/us\":%.2f, "
-		"\"std/us\":%.2f}",
+		"\"std/us\":%.2f, "
+		"\"p50/us\":%.2f, "
+		"\"p90/us\":%.2f, "
+		"\"p99/us\":%.2f, "
+		"\"p99.9/us\":%.2f}",
 		ts,
 		hostname,
 		alias,
@@ -73,7 +80,11 @@ static status output_json(double secs, microsec now, const char *alias)
 		receiver_get_mcast_min_latency(rcvr),
 		receiver_get_mcast_mean_latency(rcvr),
 		receiver_get_mcast_max_latency(rcvr),
-		receiver_get_mcast_stddev_latency(rcvr)) < 0)
+		receiver_get_mcast_stddev_latency(rcvr),
+		receiver_get_mcast_percentile_latency(rcvr, 50),
+		receiver_get_mcast_percentile_latency(rcvr, 90),
+		receiver_get_mcast_percentile_latency(rcvr, 99),
+		receiver_get_mcast_percentile_latency(rcvr, 99.9)) < 0)
 	return error_errno("output_json: sprintf");
 
     if (reporter) {
@@ -107,10 +118,72 @@ static status output_std(double secs)
     return st;
 }
 
+static status set_totals(void)
+{
+    status st;
+    if (FAILED(st = statseg_set_total(statseg, 0, "pkt",
+			      receiver_get_total_mcast_packets_recv(rcvr))) ||
+	FAILED(st = statseg_set_total(statseg, 1, "gap",
+				  receiver_get_total_tcp_gap_count(rcvr))) ||
+	FAILED(st = statseg_set_total(statseg, 2, "tcp_bytes",
+				  receiver_get_total_tcp_bytes_recv(rcvr))) ||
+	FAILED(st = statseg_set_total(statseg, 3, "mcast_bytes",
+				  receiver_get_total_mcast_bytes_recv(rcvr))))
+	return st;
+
+    return OK;
+}
+
+static status publish_totals(microsec now)
+{
+    status st;
+    if (FAILED(st = statseg_begin(statseg)) ||
+	FAILED(st = set_totals()))
+	return st;
+
+    return statseg_end(statseg, now);
+}
+
+static status publish_stats(microsec now, microsec interval)
+{
+    struct statseg_latency lat;
+    status st;
+
+    if (FAILED(st = statseg_begin(statseg)) ||
+	FAILED(st = statseg_set_interval(statseg, interval)) ||
+	FAILED(st = set_totals()) ||
+	FAILED(st = statseg_set_counter(statseg, 0, "pkt",
+				    receiver_get_mcast_packets_recv(rcvr))) ||
+	FAILED(st = statseg_set_counter(statseg, 1, "gap",
+					receiver_get_tcp_gap_count(rcvr))) ||
+	FAILED(st = statseg_set_counter(statseg, 2, "tcp_bytes",
+					receiver_get_tcp_bytes_recv(rcvr))) ||
+	FAILED(st = statseg_set_counter(statseg, 3, "mcast_bytes",
+					receiver_get_mcast_bytes_recv(rcvr))))
+	return st;
+
+    strcpy(lat.name, "mcast");
+    lat.count = receiver_get_mcast_packets_recv(rcvr);
+    lat.min = receiver_get_mcast_min_latency(rcvr);
+    lat.mean = receiver_get_mcast_mean_latency(rcvr);
+    lat.max = receiver_get_mcast_max_latency(rcvr);
+    lat.stddev = receiver_get_mcast_stddev_latency(rcvr);
+    lat.p50 = receiver_get_mcast_percentile_latency(rcvr, 50);
+    lat.p90 = receiver_get_mcast_percentile_latency(rcvr, 90);
+    lat.p99 = receiver_get_mcast_percentile_latency(rcvr, 99);
+    lat.p999 = receiver_get_mcast_percentile_latency(rcvr, 99.9);
+
+    if (FAILED(st = statseg_set_latency(statseg, 0, &lat)))
+	return st;
+
+    return statseg_end(statseg, now);
+}
+
 static void *stats_func(thread_handle thr)
 {
     char alias[32];
     microsec last_print;
+    int ticks = 0;
     status st;
 
     const char *storage_desc =
@@ -139,10 +212,21 @@ static void *stats_func(thread_handle thr)
 	microsec now;
 	double secs;
 	if (FAILED(st = signal_any_raised()) ||
-	    FAILED(st = clock_sleep(DISPLAY_DELAY_USEC)) ||
+	    FAILED(st = clock_sleep(statseg ? TOTALS_DELAY_USEC
+				    : DISPLAY_DELAY_USEC)) ||
 	    FAILED(st = clock_time(&now)))
 	    break;
 
+	/* NB. the running totals in the statistics segment are updated
+	   more often than the figures for each interval */
+	if (statseg && ++ticks < DISPLAY_DELAY_USEC / TOTALS_DELAY_USEC) {
+	    if (FAILED(st = publish_totals(now)))
+		break;
+
+	    continue;
+	}
+
+	ticks = 0;
 	secs = (now - last_print) / 1000000.0;
 
 	if (as_json)
@@ -150,7 +234,8 @@ static void *stats_func(thread_handle thr)
 	else
 	    output_std(secs);
 
-	if (FAILED(st = receiver_roll_stats(rcvr)))
+	if ((statseg && FAILED(st = publish_stats(now, now - last_print))) ||
+	    FAILED(st = receiver_roll_stats(rcvr)))
 	    break;
 
 	last_print = now;
@@ -171,7 +256,7 @@ static void *stats_func(thread_handle thr)
 int main(int argc, char *argv[])
 {
     thread_handle stats_thread;
-    const char *mmap_file;
+    const char *mmap_file, *stats_file = NULL;
     char tcp_addr[64], stats_addr[64];
     unsigned short tcp_port, stats_port;
     size_t q_capacity = SENDER_QUEUE_CAPACITY;
@@ -184,7 +269,7 @@ int main(int argc, char *argv[])
     strcpy(prog_name, argv[0]);
     error_set_program_name(prog_name);
 
-    while ((opt = getopt(argc, argv, "H:jLp:q:S:T:v")) != -1)
+    while ((opt = getopt(argc, argv, "H:jLM:p:q:S:T:v")) != -1)
 	switch (opt) {
 	case 'H':
 	    if (FAILED(a2i(optarg, "%u", &max_missed_hb)))
@@ -199,6 +284,9 @@ int main(int argc, char *argv[])
 	case 'L':
 	    error_with_timestamp(TRUE);
 	    break;
+	case 'M':
+	    stats_file = optarg;
+	    break;
 	case 'p':
 	    strcat(prog_name, ": ");
 	    strcat(prog_name, optarg);
@@ -238,12 +326,16 @@ int main(int argc, char *argv[])
 	FAILED(receiver_create(&rcvr, mmap_file, 0, 0, q_capacity,
                                touch_period, max_missed_hb,
                                tcp_addr, tcp_port)) ||
+	(stats_file &&
+	 FAILED(statseg_create(&statseg, stats_file,
+			       "subscriber", mmap_file))) ||
 	FAILED(thread_create(&stats_thread, stats_func, NULL)) ||
 	FAILED(receiver_run(rcvr)) ||
 	FAILED(thread_stop(stats_thread, &stats_result)) ||
 	FAILED(thread_destroy(&stats_thread)) ||
 	FAILED((status)(long)stats_result) ||
 	FAILED(reporter_destroy(&reporter)) ||
+	FAILED(statseg_destroy(&statseg)) ||
 	FAILED(receiver_destroy(&rcvr)) ||
 	FAILED(signal_remove_handler(SIGHUP)) ||
 	FAILED(signal_remove_handler(SIGINT)) ||
@@ -251,6 +343,11 @@ int main(int argc, char *argv[])
 	if (!as_json)
 	    putchar('\n');
 
+	/* NB. a stopped program's statistics should not appear to be live */
+	error_save_last();
+	statseg_destroy(&statseg);
+	error_restore_last();
+
 	error_report_fatal();
     }
 
@@ -13,7 +13,7 @@
 
 int version_get_file_major(void)
 {
-    return 1;
+    return 2;
 }
 
 int version_get_file_minor(void)
@@ -23,12 +23,12 @@ int version_get_file_minor(void)
 
 int version_get_wire_major(void)
 {
-    return 2;
+    return 3;
 }
 
 int version_get_wire_minor(void)
 {
-    return 0;
+    return 1;
 }
 
 void show_version(const char *canon_name)
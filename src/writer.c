@@ -12,8 +12,10 @@
 #include <lancaster/error.h>
 #include <lancaster/signals.h>
 #include <lancaster/storage.h>
+#include <lancaster/storage_inline.h>
 #include <lancaster/toucher.h>
 #include <lancaster/version.h>
+#include <lancaster/xalloc.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
@@ -27,12 +29,15 @@
 #define DEFAULT_TOUCH_USEC (1 * 1000000)
 
 static storage_handle store;
+static struct storage_fast_path fast;
 static microsec delay;
+static boolean is_nanosec;
 
 static void show_syntax(void)
 {
-    fprintf(stderr, "Syntax: %s [-v] [-L] [-p ERROR PREFIX] "
-	    "[-q CHANGE-QUEUE-CAPACITY] [-r] [-T TOUCH-PERIOD] "
+    fprintf(stderr, "Syntax: %s [-v] [-A] [-D] [-E] [-H HISTORY-DEPTH] [-L] "
+	    "[-N] [-p ERROR PREFIX] [-q CHANGE-QUEUE-CAPACITY] [-r] [-S] "
+	    "[-T TOUCH-PERIOD] [-U UPDATE-LOG-CAPACITY] "
 	    "STORAGE-FILE DELAY\n", error_get_program_name());
 
     exit(-SYNTAX_ERROR);
@@ -40,29 +45,17 @@ static void show_syntax(void)
 
 static status update(identifier id, long n)
 {
-    record_handle rec = NULL;
-    struct datum *d;
-    revision rev;
+    struct datum d;
     microsec now;
     status st = OK;
 
-    if (FAILED(st = signal_any_raised()) ||
-	FAILED(st = storage_get_record(store, id, &rec)) ||
-	FAILED(st = clock_time(&now)))
-	return st;
-
-    d = record_get_value_ref(rec);
-
-    if (FAILED(st = record_write_lock(rec, &rev)))
-	return st;
+    d.xyz = n;
 
-    d->xyz = n;
-
-    record_set_timestamp(rec, now);
-    record_set_revision(rec, NEXT_REV(rev));
-
-    if ((storage_get_queue_capacity(store) > 0 &&
-	 FAILED(st = storage_write_queue(store, id))) ||
+    if (FAILED(st = signal_any_raised()) ||
+	FAILED(st = (is_nanosec
+		     ? storage_time_now_ns(store, &now)
+		     : storage_time_now(store, &now))) ||
+	FAILED(st = storage_write_value(&fast, id, &d, sizeof(d), now)) ||
 	(delay > 0 && FAILED(st = clock_sleep(delay))))
 	return st;
 
@@ -77,18 +70,36 @@ int main(int argc, char *argv[])
     size_t q_capacity = DEFAULT_QUEUE_CAPACITY;
     microsec touch_period = DEFAULT_TOUCH_USEC;
     boolean at_random = FALSE;
+    struct storage_options opts;
     long xyz = 0;
     int opt;
 
     char prog_name[256];
     strcpy(prog_name, argv[0]);
     error_set_program_name(prog_name);
+    BZERO(&opts);
 
-    while ((opt = getopt(argc, argv, "Lp:q:rT:v")) != -1)
+    while ((opt = getopt(argc, argv, "ADEH:LNp:q:rST:U:v")) != -1)
 	switch (opt) {
+	case 'A':
+	    opts.flags |= STORAGE_ATOMIC;
+	    break;
+	case 'D':
+	    opts.flags |= STORAGE_DOUBLE;
+	    break;
+	case 'E':
+	    opts.flags |= STORAGE_TRACED;
+	    break;
+	case 'H':
+	    if (FAILED(a2i(optarg, "%lu", &opts.history_depth)))
+		error_report_fatal();
+	    break;
 	case 'L':
 	    error_with_timestamp(TRUE);
 	    break;
+	case 'N':
+	    opts.flags |= STORAGE_NANOSEC;
+	    break;
 	case 'p':
 	    strcat(prog_name, ": ");
 	    strcat(prog_name, optarg);
@@ -101,10 +112,17 @@ int main(int argc, char *argv[])
 	case 'r':
 	    at_random = TRUE;
 	    break;
+	case 'S':
+	    opts.flags |= STORAGE_SPARSE;
+	    break;
 	case 'T':
 	    if (FAILED(a2i(optarg, "%ld", &touch_period)))
 		error_report_fatal();
 	    break;
+	case 'U':
+	    if (FAILED(a2i(optarg, "%lu", &opts.log_capacity)))
+		error_report_fatal();
+	    break;
 	case 'v':
 	    show_version("writer");
 	    /* fall through */
@@ -116,15 +134,17 @@ int main(int argc, char *argv[])
 	show_syntax();
 
     mmap_file = argv[optind++];
+    is_nanosec = ((opts.flags & STORAGE_NANOSEC) != 0);
 
     if (FAILED(a2i(argv[optind++], "%ld", &delay)) ||
 	FAILED(signal_add_handler(SIGHUP)) ||
 	FAILED(signal_add_handler(SIGINT)) ||
 	FAILED(signal_add_handler(SIGTERM)) ||
-	FAILED(storage_create(&store, mmap_file, O_RDWR | O_CREAT, 0,
-			      FALSE, 0, MAX_ID, sizeof(struct datum), 0,
-			      q_capacity, "TEST")) ||
+	FAILED(storage_create2(&store, mmap_file, O_RDWR | O_CREAT, 0,
+			       FALSE, 0, MAX_ID, sizeof(struct datum), 0,
+			       q_capacity, "TEST", &opts)) ||
 	FAILED(storage_reset(store)) ||
+	FAILED(storage_get_fast_path(store, &fast)) ||
 	FAILED(toucher_create(&toucher, touch_period)) ||
 	FAILED(toucher_add_storage(toucher, store)))
 	error_report_fatal();